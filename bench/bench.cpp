@@ -0,0 +1,153 @@
+#include "generator.h"
+#include "tclap/CmdLine.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+// Time growth above scale^SUPERLINEAR_EXPONENT between two consecutive scales is reported
+#define SUPERLINEAR_EXPONENT 1.25
+// Timings below this many milliseconds are too noisy to judge scaling from
+#define MIN_SIGNIFICANT_MS 20.0
+
+struct Sample {
+    int scale;
+    std::size_t lines, bytes;
+    double milliseconds;
+    std::map<std::string, double> phases; // From --time-report
+};
+
+static std::string quote(const std::string &str) {
+    return "\"" + str + "\"";
+}
+
+// Reads the phase table written by --time-report
+static std::map<std::string, double> readTimeReport(const std::string &path) {
+    std::map<std::string, double> phases;
+    std::ifstream is(path);
+    std::string line;
+    std::getline(is, line); // Header
+    while(std::getline(is, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double milliseconds;
+        if(!(fields >> name >> milliseconds)) break;
+        if(name != "Total") phases[name] = milliseconds;
+    }
+    return phases;
+}
+
+static Sample runCompiler(const std::string &compiler, const GeneratedProgram &program, const std::string &directory, int scale) {
+    std::string output = (std::filesystem::path(directory) / "main.asm").string();
+    std::string report = (std::filesystem::path(directory) / "report.txt").string();
+    std::string command = quote(compiler) + " " + quote(program.mainFile) + " -I " + quote(directory) + " -o " + quote(output) + " --time-report 2> " + quote(report);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int status = std::system(command.c_str());
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    if(status != 0) {
+        std::cerr << "Error: the compiler failed on " << program.mainFile << ", see " << report << std::endl;
+        exit(1);
+    }
+
+    return Sample{scale, program.lines, program.bytes, std::chrono::duration<double, std::milli>(end - start).count(), readTimeReport(report)};
+}
+
+// The exponent k for which time grows like size^k between two samples
+static double scalingExponent(double smallTime, double largeTime, const Sample &small, const Sample &large) {
+    return std::log(largeTime / smallTime) / std::log(static_cast<double>(large.bytes) / small.bytes);
+}
+
+static bool checkScaling(const std::string &shape, const std::string &phase, double smallTime, double largeTime, const Sample &small, const Sample &large) {
+    if(largeTime < MIN_SIGNIFICANT_MS || smallTime <= 0) return false;
+    double exponent = scalingExponent(smallTime, largeTime, small, large);
+    if(exponent <= SUPERLINEAR_EXPONENT) return false;
+    std::cout << "  superlinear: " << shape << " " << phase << " grows as size^" << std::fixed << std::setprecision(2) << exponent
+        << " from scale " << small.scale << " to " << large.scale << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string compiler;
+    std::string workDir;
+    std::vector<int> scales;
+    std::vector<std::string> selectedShapes;
+    bool strict = false;
+    try
+    {
+        TCLAP::CmdLine cmd("Measures the throughput of the Arsenic compiler on generated programs", ' ', "1");
+
+        TCLAP::ValueArg<std::string> compilerArg("c", "compiler", "The compiler to benchmark", false, "bin/arsenic.exe", "path", cmd);
+        TCLAP::ValueArg<std::string> workArg("w", "workdir", "The directory to generate programs in", false, "bin/bench/work", "path", cmd);
+        TCLAP::MultiArg<int> scaleArg("n", "scale", "A program scale to measure. Defaults to 1, 2, 4 and 8", false, "count", cmd);
+        TCLAP::MultiArg<std::string> shapeArg("s", "shape", "A program shape to measure. Defaults to all of them", false, "name", cmd);
+        TCLAP::SwitchArg strictArg("", "strict", "Exit with an error if any phase scales superlinearly", cmd);
+
+        cmd.parse(argc, argv);
+
+        compiler = compilerArg.getValue();
+        workDir = workArg.getValue();
+        scales = scaleArg.getValue();
+        selectedShapes = shapeArg.getValue();
+        strict = strictArg.getValue();
+    }
+    catch(TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        exit(1);
+    }
+
+    if(scales.empty()) scales = {1, 2, 4, 8};
+    std::sort(scales.begin(), scales.end());
+
+    if(!std::filesystem::exists(compiler)) {
+        std::cerr << "Error: cannot find compiler: " << compiler << std::endl;
+        exit(1);
+    }
+
+    bool superlinear = false;
+
+    for(const std::pair<std::string, Shape> &shape : shapes()) {
+        if(!selectedShapes.empty() && std::find(selectedShapes.begin(), selectedShapes.end(), shape.first) == selectedShapes.end()) continue;
+
+        std::cout << shape.first << std::endl;
+        std::cout << "  " << std::setw(6) << "scale" << std::setw(9) << "lines" << std::setw(12) << "time (ms)" << std::setw(12) << "lines/s";
+        std::cout << "   phases (ms)" << std::endl;
+
+        std::vector<Sample> samples;
+        for(int scale : scales) {
+            std::string directory = (std::filesystem::path(workDir) / (shape.first + "_" + std::to_string(scale))).string();
+            std::filesystem::remove_all(directory);
+            GeneratedProgram program = generateProgram(shape.second, scale, directory);
+            Sample sample = runCompiler(compiler, program, directory, scale);
+
+            std::cout << "  " << std::setw(6) << sample.scale << std::setw(9) << sample.lines << std::fixed << std::setprecision(1)
+                << std::setw(12) << sample.milliseconds << std::setw(12) << std::setprecision(0) << sample.lines / (sample.milliseconds / 1000) << "  ";
+            for(const std::pair<const std::string, double> &phase : sample.phases) std::cout << " " << phase.first << "=" << std::setprecision(1) << phase.second;
+            std::cout << std::endl;
+
+            samples.push_back(sample);
+        }
+
+        for(std::size_t i = 1; i < samples.size(); i++) {
+            const Sample &small = samples[i - 1], &large = samples[i];
+            superlinear |= checkScaling(shape.first, "total", small.milliseconds, large.milliseconds, small, large);
+            for(const std::pair<const std::string, double> &phase : large.phases) {
+                if(!small.phases.count(phase.first)) continue;
+                superlinear |= checkScaling(shape.first, phase.first, small.phases.at(phase.first), phase.second, small, large);
+            }
+        }
+    }
+
+    if(superlinear) std::cout << "Some phases scale superlinearly" << std::endl;
+
+    return strict && superlinear ? 1 : 0;
+}
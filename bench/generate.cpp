@@ -0,0 +1,42 @@
+#include "generator.h"
+#include "tclap/CmdLine.h"
+#include <iostream>
+
+int main(int argc, char **argv)
+{
+    std::string shapeName;
+    int scale = 1;
+    std::string outputDir;
+    try
+    {
+        TCLAP::CmdLine cmd("Generates a synthetic Arsenic program for benchmarking the compiler", ' ', "1");
+
+        std::vector<std::string> shapeNames;
+        for(const std::pair<std::string, Shape> &shape : shapes()) shapeNames.push_back(shape.first);
+        TCLAP::ValuesConstraint<std::string> shapeConstraint(shapeNames);
+
+        TCLAP::ValueArg<std::string> shapeArg("s", "shape", "The dimension of the program which grows with the scale", false, "functions", &shapeConstraint, cmd);
+        TCLAP::ValueArg<int> scaleArg("n", "scale", "The size of the program. Its length grows linearly with this value", false, 1, "count", cmd);
+        TCLAP::UnlabeledValueArg<std::string> outputArg("output", "The directory to write the program to", true, "", "path", cmd);
+
+        cmd.parse(argc, argv);
+
+        shapeName = shapeArg.getValue();
+        scale = scaleArg.getValue();
+        outputDir = outputArg.getValue();
+    }
+    catch(TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        exit(1);
+    }
+
+    Shape shape = Shape::Functions;
+    for(const std::pair<std::string, Shape> &candidate : shapes()) if(candidate.first == shapeName) shape = candidate.second;
+
+    GeneratedProgram program = generateProgram(shape, scale, outputDir);
+
+    std::cout << program.mainFile << ": " << program.files.size() << " files, " << program.lines << " lines" << std::endl;
+
+    return 0;
+}
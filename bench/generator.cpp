@@ -0,0 +1,160 @@
+#include "generator.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+const std::vector<std::pair<std::string, Shape>> &shapes() {
+    static const std::vector<std::pair<std::string, Shape>> allShapes = {
+        {"functions", Shape::Functions},
+        {"nesting", Shape::Nesting},
+        {"expressions", Shape::Expressions},
+        {"structs", Shape::Structs},
+        {"includes", Shape::Includes}
+    };
+    return allShapes;
+}
+
+static std::string indent(int level) {
+    return std::string(4 * level, ' ');
+}
+
+static const char *const operators[] = {"+", "-", "*", "&", "|", "^", "<<", ">>"};
+static const char *const comparisons[] = {"<", ">", "<=", ">=", "==", "!="};
+
+// A long expression over the variables a, b and c
+static std::string expression(int terms, int seed) {
+    std::string expr = "a";
+    for(int i = 1; i < terms; i++) {
+        const char *op = operators[(seed + i) % 8];
+        const char *operand = (i % 3 == 0) ? "b" : (i % 3 == 1) ? "c" : "a";
+        if(i % 5 == 0) expr += std::string(" ") + op + " (" + operand + " " + operators[(seed + 2 * i) % 8] + " " + std::to_string(i) + ")";
+        else expr += std::string(" ") + op + " " + operand;
+    }
+    return expr;
+}
+
+// A function with a few locals, a branch, a loop and a call to the previous function
+static void writeFunction(std::ostream &os, const std::string &name, const std::string &callee, int seed) {
+    os << name << ":\n";
+    os << indent(1) << "qword a = " << seed << "\n";
+    os << indent(1) << "qword b = a * 3 + 1\n";
+    os << indent(1) << "dword c = (a - b) | " << seed % 7 << "\n";
+    os << indent(1) << "if a " << comparisons[seed % 6] << " b:\n";
+    os << indent(2) << "qword d = a + c\n";
+    os << indent(2) << "b = d ^ b\n";
+    os << indent(1) << "else:\n";
+    os << indent(2) << "b = b - 1\n";
+    os << indent(1) << "while c < 10:\n";
+    os << indent(2) << "c = c + 1\n";
+    if(!callee.empty()) os << indent(1) << callee << "(a, b)\n";
+    os << indent(1) << "return = b\n";
+    os << "\n";
+}
+
+static void writeNesting(std::ostream &os, const std::string &name, int depth) {
+    os << name << ":\n";
+    os << indent(1) << "qword v0 = 1\n";
+    for(int level = 0; level < depth; level++) {
+        const char *keyword = level % 2 == 0 ? "if" : "while";
+        os << indent(level + 1) << keyword << " v" << level << " < " << depth << ":\n";
+        os << indent(level + 2) << "qword v" << level + 1 << " = v" << level << " + 1\n";
+        if(level % 2 == 1) os << indent(level + 2) << "v" << level << " = v" << level << " + 1\n";
+    }
+    os << indent(1) << "return = v0\n";
+    os << "\n";
+}
+
+static void writeExpressions(std::ostream &os, const std::string &name, int terms, int seed) {
+    os << name << ":\n";
+    os << indent(1) << "qword a = " << seed << "\n";
+    os << indent(1) << "qword b = " << seed + 1 << "\n";
+    os << indent(1) << "qword c = " << seed + 2 << "\n";
+    for(int i = 0; i < 4; i++) {
+        os << indent(1) << "abc"[i % 3] << " = " << expression(terms, seed + i) << "\n";
+    }
+    os << indent(1) << "if " << expression(terms / 2 + 1, seed) << " " << comparisons[seed % 6] << " " << expression(terms / 2 + 1, seed + 1) << ":\n";
+    os << indent(2) << "a = b\n";
+    os << "\n";
+}
+
+static void writeStructs(std::ostream &os, int first, int count) {
+    for(int i = first; i < first + count; i++) {
+        os << "struct S" << i << " qword x qword y dword z word w byte t\n";
+        if(i > 0) os << "struct N" << i << " struct S" << i - 1 << " qword tail\n";
+    }
+    os << "\n";
+    for(int i = first; i < first + count; i++) {
+        os << "use_s" << i << ":\n";
+        os << indent(1) << "qword p > 64{}\n";
+        os << indent(1) << "qword x = ((struct S" << i << ")p).x\n";
+        os << indent(1) << "qword y = ((struct S" << i << ")p).y + x\n";
+        os << indent(1) << "dword z = ((struct S" << i << ")p).z\n";
+        if(i > 0) os << indent(1) << "qword tail = ((struct N" << i << ")p).tail\n";
+        os << indent(1) << "delete p\n";
+        os << "\n";
+    }
+}
+
+static std::size_t countLines(const std::string &text) {
+    std::size_t lines = 0;
+    for(char c : text) if(c == '\n') lines++;
+    return lines;
+}
+
+static void writeFile(GeneratedProgram &program, const std::string &path, const std::string &text) {
+    std::ofstream os(path);
+    if(!os) {
+        std::cerr << "Error: cannot write " << path << std::endl;
+        exit(1);
+    }
+    os << text;
+    program.files.push_back(path);
+    program.lines += countLines(text);
+    program.bytes += text.size();
+}
+
+GeneratedProgram generateProgram(Shape shape, int scale, const std::string &directory) {
+    std::filesystem::create_directories(directory);
+    GeneratedProgram program;
+    program.mainFile = (std::filesystem::path(directory) / "main.ars").string();
+    std::ostringstream main;
+    main << "; Generated benchmark program\n";
+
+    switch(shape) {
+        case Shape::Functions: {
+            int count = 16 * scale;
+            for(int i = 0; i < count; i++) writeFunction(main, "f" + std::to_string(i), i == 0 ? "" : "f" + std::to_string(i - 1), i);
+            main << "f" << count - 1 << "()\n";
+            break;
+        }
+        case Shape::Nesting:
+            // Four functions nested 8 * scale levels deep
+            for(int i = 0; i < 4; i++) writeNesting(main, "n" + std::to_string(i), 8 * scale);
+            for(int i = 0; i < 4; i++) main << "n" << i << "()\n";
+            break;
+        case Shape::Expressions:
+            // Eight functions whose expressions have 16 * scale terms
+            for(int i = 0; i < 8; i++) writeExpressions(main, "e" + std::to_string(i), 16 * scale, i);
+            for(int i = 0; i < 8; i++) main << "e" << i << "()\n";
+            break;
+        case Shape::Structs:
+            writeStructs(main, 0, 16 * scale);
+            break;
+        case Shape::Includes: {
+            // Every included file includes the next one, and the main file includes all of them
+            int count = 4 * scale;
+            for(int i = 0; i < count; i++) {
+                std::ostringstream include;
+                if(i + 1 < count) include << "#include \"inc" << i + 1 << ".ars\"\n";
+                for(int j = 0; j < 4; j++) writeFunction(include, "i" + std::to_string(i) + "_" + std::to_string(j), j == 0 ? "" : "i" + std::to_string(i) + "_" + std::to_string(j - 1), i + j);
+                writeFile(program, (std::filesystem::path(directory) / ("inc" + std::to_string(i) + ".ars")).string(), include.str());
+                main << "#include \"inc" << i << ".ars\"\n";
+            }
+            break;
+        }
+    }
+
+    writeFile(program, program.mainFile, main.str());
+    return program;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The dimension of an Arsenic program that grows with the scale
+enum class Shape {
+    Functions, // Many small functions which call each other
+    Nesting, // if and while blocks nested deeper and deeper
+    Expressions, // Long arithmetic and comparison expressions
+    Structs, // Many structs and member accesses
+    Includes // Many included files
+};
+
+struct GeneratedProgram {
+    std::string mainFile;
+    std::vector<std::string> files; // Every generated file, including the main file
+    std::size_t lines = 0;
+    std::size_t bytes = 0;
+};
+
+const std::vector<std::pair<std::string, Shape>> &shapes();
+
+// Writes a deterministic program of the given shape into directory. Its size grows linearly with scale
+GeneratedProgram generateProgram(Shape shape, int scale, const std::string &directory);
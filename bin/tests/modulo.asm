@@ -0,0 +1,117 @@
+[bits 64]
+DEFAULT REL
+%macro pushaq 0
+push rax
+push rbx
+push rcx
+push rdx
+push r8
+push r9
+push r10
+push r11
+push r12
+push r13
+push r14
+push r15
+push rsi
+push rdi
+%endmacro
+%macro popaq 0
+pop rdi
+pop rsi
+pop r15
+pop r14
+pop r13
+pop r12
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdx
+pop rcx
+pop rbx
+pop rax
+%endmacro
+arsenic:
+push rbp
+mov rbp, rsp
+sub rsp, 32
+pushaq
+pushfq
+lea rax, [rbp-16]
+mov rbx, 0
+mov [rax], rbx
+lea rax, [rbp-16]
+mov rbx, 0x2dfdc1c35
+mov [rax], rbx
+lea rax, [rbp-24]
+push rax
+mov rax, [rbp-16]
+push rdx
+mov rbx, rax
+mov rax, 0x6e80fe012fd74cf1
+mul rbx
+mov rax, rbx
+sub rax, rdx
+shr rax, 1
+add rax, rdx
+shr rax, 31
+pop rdx
+mov rbx, rax
+pop rax
+mov [rax], rbx
+lea rax, [rbp-32]
+push rax
+mov rax, [rbp-16]
+mov rbx, rax
+mov rax, 0x6e80fe012fd74cf1
+mul rbx
+mov rax, rbx
+sub rax, rdx
+shr rax, 1
+add rax, rdx
+shr rax, 31
+mov rdx, 0xb2d05e01
+imul rax, rdx
+sub rbx, rax
+mov rax, rbx
+mov rbx, rax
+pop rax
+mov [rax], rbx
+arsenic_u0_cif0:
+mov rax, [rbp-24]
+cmp rax, 4
+jz arsenic_u0_cif0_cel
+lea rax, [rbp-8]
+mov rbx, 1
+mov [rax], rbx
+popfq
+popaq
+leave
+ret
+arsenic_u0_cif0_cel:
+arsenic_u0_cif0_e:
+arsenic_u0_cif1:
+mov rax, [rbp-32]
+cmp rax, 0x149aa431
+jz arsenic_u0_cif1_cel
+lea rax, [rbp-8]
+mov rbx, 2
+mov [rax], rbx
+popfq
+popaq
+leave
+ret
+arsenic_u0_cif1_cel:
+arsenic_u0_cif1_e:
+lea rax, [rbp-8]
+mov rbx, 0
+mov [rax], rbx
+popfq
+popaq
+leave
+ret
+popfq
+popaq
+leave
+ret
@@ -0,0 +1,98 @@
+[bits 64]
+DEFAULT REL
+%macro pushaq 0
+push rax
+push rbx
+push rcx
+push rdx
+push r8
+push r9
+push r10
+push r11
+push r12
+push r13
+push r14
+push r15
+push rsi
+push rdi
+%endmacro
+%macro popaq 0
+pop rdi
+pop rsi
+pop r15
+pop r14
+pop r13
+pop r12
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdx
+pop rcx
+pop rbx
+pop rax
+%endmacro
+arsenic:
+push rbp
+mov rbp, rsp
+sub rsp, 16
+pushaq
+pushfq
+push rax
+lea rax, [arsenic_vx]
+mov rbx, 7
+mov [rax], rbx
+lea rax, [arsenic_vy]
+mov rbx, 0
+mov [rax], rbx
+pop rax
+jmp arsenic_ff_e
+arsenic_ff:
+push rbp
+mov rbp, rsp
+sub rsp, 8
+arsenic_ff_cif0:
+push rax
+lea rax, [arsenic_vy]
+mov rbx, [arsenic_vx]
+mov [rax], rbx
+pop rax
+arsenic_ff_cif0_cel:
+arsenic_ff_cif0_e:
+leave
+ret
+arsenic_ff_e:
+push rax
+lea rax, [rbp-16]
+mov rbx, 0
+mov [rax], rbx
+pop rax
+sub rsp, 32
+call arsenic_ff
+add rsp, 32
+arsenic_u0_cif0:
+mov rax, [arsenic_vy]
+cmp rax, 7
+jz arsenic_u0_cif0_cel
+lea rax, [rbp-8]
+mov rbx, 1
+mov [rax], rbx
+popfq
+popaq
+leave
+ret
+arsenic_u0_cif0_cel:
+arsenic_u0_cif0_e:
+lea rax, [rbp-8]
+mov rbx, 0
+mov [rax], rbx
+popfq
+popaq
+leave
+ret
+popfq
+popaq
+leave
+ret
+arsenic_vx dq 0
+arsenic_vy dq 0
@@ -1,130 +1,116 @@
+#include "cache.h"
 #include "compiler.h"
+#include "emitter.h"
+#include "fold.h"
+#include "frames.h"
+#include "includes.h"
+#include "profile.h"
+#include "regalloc.h"
 #include "transformer.h"
 #include "tclap/CmdLine.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <regex>
-
-std::string remove_comments(std::string str) {
-    int lastIdx = str.length();
-    bool quotes = false;
-    for(std::size_t i = 0; i < str.length(); i++) {
-        if(str[i] == '"' || str[i] == '\'') {
-            quotes = !quotes;
-        }
-        if(quotes && str[i] == '\\') {
-            i++;
-            continue;
-        }
-        if(';' == str[i] && !quotes) {
-            lastIdx = i;
-            break;
-        }
-    }
-    return str.substr(0, lastIdx);
-}
+#include <thread>
 
 void compileFile(
-    std::shared_ptr<Context> ctx,
-    std::string fileName,
-    std::vector<std::string> &compiledCode,
+    Context *ctx,
+    const Block &program,
+    const ScopeTable &scopes,
+    Code &compiledCode,
     std::vector<std::string> &definitions
 ) {
-    std::ifstream file(fileName);
-    std::string line;
-    std::function<std::unique_ptr<std::string>()> getLine = [&]() {
-        return std::unique_ptr<std::string>(std::getline(file, line) ? new std::string(remove_comments(line)) : nullptr);
-    };
-    while (std::getline(file, line)) compileLine(ctx, remove_comments(line), getLine, compiledCode, definitions, file);
-    file.close();
+    for(const Statement &statement : program) compileLine(ctx, statement, scopes, compiledCode, definitions);
 }
 
 void preprocessFile(
-    std::shared_ptr<Context> ctx,
-    std::string fileName,
+    Context *ctx,
+    const Block &program,
+    ScopeTable &scopes,
     std::map<std::string, Variable> &variables,
     std::vector<std::string> &definitions
 ) {
-    std::ifstream file(fileName);
-    std::string line;
-    std::function<std::unique_ptr<std::string>()> getLine = [&]() {
-        return std::unique_ptr<std::string>(std::getline(file, line) ? new std::string(remove_comments(line)) : nullptr);
-    };
-    while (std::getline(file, line)) {
-        line = remove_comments(line);
-        trim(line);
-        std::smatch match;
-        if(std::regex_match(line, match, std::regex("const\\s+([^\\s]+)\\s*=\\s*(.+)"))) {
-            std::string varName = match[1];
-            std::string varValue = match[2];
-            variables.emplace(varName, constVar(varName));
-            definitions.push_back(string_format("%s_v%s equ %s", ctx->name.c_str(), varName.c_str(), varValue.c_str()));
-            return;
-        }
-        if(std::regex_match(line, match, std::regex("global\\s+(byte|word|dword|qword)\\s+([^\\s=>]+)(?:\\s*[=>].*)"))) {
-            std::string varSize = match[1];
-            std::string varName = match[2];
-            int size = getVarSize(varSize);
-            variables.emplace(varName, globalVar(varName, size));
-            definitions.push_back(string_format("%s_v%s %s 0", ctx->name.c_str(), varName.c_str(), getGlobalSize(size).c_str()));
-            return;
-        }
-    }
-    file.clear();
-    file.seekg(0);
-    std::map<std::string, Variable> nVariables = preprocessFunction(ctx, 0, getLine, file);
+    discoverScopes(ctx, program, scopes, variables, definitions, true);
+    const std::map<std::string, Variable> &nVariables = findScope(scopes, program);
     variables.insert(nVariables.begin(), nVariables.end());
-    file.close();
 }
 
-void getIncludes(std::string file, std::vector<std::string> &includes)
-{
-    std::ifstream f(file);
-    std::string line;
-    while (std::getline(f, line)) {
-        line = remove_comments(line);
-        std::smatch match;
-        if (std::regex_search(line, match, std::regex("#include\\s+\"(.*)\""))) {
-            includes.push_back(match[1]);
-        }
-    }
-    f.close();
+void writeQMacros(AsmWriter &os) {
+    os.line("%macro pushaq 0");
+    os.line("push rax");
+    os.line("push rbx");
+    os.line("push rcx");
+    os.line("push rdx");
+    os.line("push r8");
+    os.line("push r9");
+    os.line("push r10");
+    os.line("push r11");
+    os.line("push r12");
+    os.line("push r13");
+    os.line("push r14");
+    os.line("push r15");
+    os.line("push rsi");
+    os.line("push rdi");
+    os.line("%endmacro");
+    os.line("%macro popaq 0");
+    os.line("pop rdi");
+    os.line("pop rsi");
+    os.line("pop r15");
+    os.line("pop r14");
+    os.line("pop r13");
+    os.line("pop r12");
+    os.line("pop r11");
+    os.line("pop r10");
+    os.line("pop r9");
+    os.line("pop r8");
+    os.line("pop rdx");
+    os.line("pop rcx");
+    os.line("pop rbx");
+    os.line("pop rax");
+    os.line("%endmacro");
 }
 
-void writeQMacros(std::ostream &os) {
-    os << "%macro pushaq 0\n";
-    os << "push rax\n";
-    os << "push rbx\n";
-    os << "push rcx\n";
-    os << "push rdx\n";
-    os << "push r8\n";
-    os << "push r9\n";
-    os << "push r10\n";
-    os << "push r11\n";
-    os << "push r12\n";
-    os << "push r13\n";
-    os << "push r14\n";
-    os << "push r15\n";
-    os << "push rsi\n";
-    os << "push rdi\n";
-    os << "%endmacro\n";
-    os << "%macro popaq 0\n";
-    os << "pop rdi\n";
-    os << "pop rsi\n";
-    os << "pop r15\n";
-    os << "pop r14\n";
-    os << "pop r13\n";
-    os << "pop r12\n";
-    os << "pop r11\n";
-    os << "pop r10\n";
-    os << "pop r9\n";
-    os << "pop r8\n";
-    os << "pop rdx\n";
-    os << "pop rcx\n";
-    os << "pop rbx\n";
-    os << "pop rax\n";
-    os << "%endmacro\n";
+void emitAssembly(
+    AsmWriter &os,
+    const std::string &symbolFile,
+    int rootStackSize,
+    const Code &compiledCode,
+    const std::vector<std::string> &definitions
+) {
+    if(!symbolFile.empty()) {
+        os.text("[map symbols ");
+        os.text(symbolFile);
+        os.line("]");
+    }
+
+    os.line("[bits 64]");
+    os.line("DEFAULT REL");
+
+    writeQMacros(os);
+
+    os.line("arsenic:");
+
+    os.line("push rbp");
+    os.line("mov rbp, rsp");
+    if(rootStackSize != 0) {
+        os.text("sub rsp, ");
+        os.number(rootStackSize);
+        os.line("");
+    }
+
+    os.line("pushaq");
+    os.line("pushfq");
+
+    for(const Instruction &instruction : compiledCode.instructions) os.instruction(compiledCode, instruction);
+
+    os.line("popfq");
+    os.line("popaq");
+
+    os.line("leave");
+
+    os.line("ret");
+
+    for(const std::string &line : definitions) os.line(line);
 }
 
 int main(int argc, char **argv)
@@ -135,6 +121,12 @@ int main(int argc, char **argv)
     std::string makeTarget;
     std::string symbolFile;
     std::string outputFile;
+    std::string cacheDir;
+    bool timeReport = false;
+    std::string tracePath;
+    unsigned jobs = 1;
+    bool registerLocals = false;
+    bool signedComparisons = false;
     std::vector<std::string> inputFiles;
     try
     {
@@ -146,6 +138,12 @@ int main(int argc, char **argv)
         TCLAP::ValueArg<std::string> makeTargetArg("T", "target", "Changes the make dependency target. If unspecified, it will be the name of the output file", false, "", "name", cmd);
         TCLAP::ValueArg<std::string> symbolOutputArg("S", "symbols", "Specifies an output file to write symbol locations", false, "", "path", cmd);
         TCLAP::ValueArg<std::string> outputArg("o", "outfile", "The path to the output file", false, "", "path", cmd);
+        TCLAP::ValueArg<std::string> cacheArg("C", "cache", "A directory in which to cache compiled output, keyed by a hash of the input files, their includes, and the compiler", false, "", "path", cmd);
+        TCLAP::SwitchArg timeReportArg("", "time-report", "Reports the time, allocations and peak memory use of each compiler phase", cmd);
+        TCLAP::ValueArg<std::string> traceArg("", "trace", "Writes a Chrome trace of the compiler phases and of each compiled function to the given file", false, "", "path", cmd);
+        TCLAP::SwitchArg registerLocalsArg("", "register-locals", "Keeps the most used local variables of each function in registers instead of their stack frames", cmd);
+        TCLAP::SwitchArg signedComparisonsArg("", "signed-compare", "Compares values with <, <=, > and >= as signed integers instead of unsigned ones", cmd);
+        TCLAP::ValueArg<unsigned> jobsArg("j", "jobs", "The number of files to compile in parallel. 0 uses one job per hardware thread", false, 1, "count", cmd);
         TCLAP::UnlabeledMultiArg<std::string> inputArg("input", "The input file(s)", true, "path", cmd);
 
         cmd.parse(argc, argv);
@@ -157,6 +155,12 @@ int main(int argc, char **argv)
         symbolFile = symbolOutputArg.getValue();
         outputFile = outputArg.getValue();
         inputFiles = inputArg.getValue();
+        jobs = jobsArg.getValue();
+        registerLocals = registerLocalsArg.getValue();
+        signedComparisons = signedComparisonsArg.getValue();
+        cacheDir = cacheArg.getValue();
+        timeReport = timeReportArg.getValue();
+        tracePath = traceArg.getValue();
     }
     catch(TCLAP::ArgException &e)
     {
@@ -164,8 +168,15 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    Context rootCtx = Context{"arsenic", defaultVars(), std::map<std::string, Struct_>(), std::map<std::string, std::string>(), nullptr, nullptr, 0, 1};
-    rootCtx.root = std::make_shared<Context>(rootCtx);
+    if(timeReport) enableTimeReport();
+    if(!tracePath.empty()) enableTrace();
+
+    if(jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    std::map<std::string, Variable> rootVariables = defaultVars();
+    Context rootCtx = Context{"arsenic", &rootVariables, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), nullptr, nullptr, true, 0};
+    rootCtx.root = &rootCtx;
+    rootCtx.signedComparisons = signedComparisons;
 
     includePath.push_back(".");
 
@@ -180,25 +191,14 @@ int main(int argc, char **argv)
         return nPath;
     });
 
-    std::vector<std::string> includeSearchFiles(inputFiles);
-
-    while(!includeSearchFiles.empty()) {
-        std::vector<std::string> includes;
-        for(std::string file: includeSearchFiles) getIncludes(file, includes);
-        std::transform(includes.begin(), includes.end(), includes.begin(), [&includePath = transformedIncludePath](std::string file) {
-            for(std::filesystem::path dir: includePath) {
-                std::filesystem::path fullPath = dir / file;
-                if(std::filesystem::exists(fullPath)) return fullPath.string();
-            }
-            std::cerr << "Cannot find included file: " << file << std::endl;
-            exit(1);
-        });
-        includes.erase(std::unique(includes.begin(), includes.end()), includes.end());
-        inputFiles.insert(inputFiles.end(), includes.begin(), includes.end());
-        includeSearchFiles = includes;
+    IncludeGraph includeGraph;
+
+    {
+        ProfileScope phase("includes");
+        includeGraph = buildIncludeGraph(inputFiles, transformedIncludePath, jobs);
     }
 
-    inputFiles.erase(std::unique(inputFiles.begin(), inputFiles.end()), inputFiles.end());
+    inputFiles = includeGraph.files;
 
     if(!makefilePath.empty()) {
         std::ofstream makefile(makefilePath);
@@ -212,44 +212,100 @@ int main(int argc, char **argv)
         makefile.close();
     }
 
-    std::vector<std::string> compiledCode, definitions;
+    std::string cacheEntry, cached;
+    bool cacheHit = false;
 
-    for(std::string file: inputFiles) preprocessFile(rootCtx.root, file, rootCtx.variables, definitions);
+    if(!cacheDir.empty()) {
+        ProfileScope phase("cache");
+        // Everything besides the sources which changes the generated assembly
+        std::string settings = string_format("compiler=%s\nsymbols=%s\nregister-locals=%d\nsigned-compare=%d\n", compilerIdentity(argv[0]).c_str(), symbolFile.c_str(), registerLocals, signedComparisons);
+        cacheEntry = cacheKey(includeGraph, settings);
+        cacheHit = readCache(cacheDir, cacheEntry, cached);
+    }
 
-    for(std::string file: inputFiles) compileFile(rootCtx.root, file, compiledCode, definitions);
+    // Handled once the cache phase has ended, so that it appears in the profile
+    if(cacheHit) {
+        if(!outputFile.empty() && !writeOutput(outputFile, cached)) {
+            std::cerr << "Error: could not write " << outputFile << std::endl;
+            exit(1);
+        }
+        recordCounter("cache hit", 1);
+        finishProfile(tracePath);
+        return 0;
+    }
 
-    while(transform_code(compiledCode));
+    std::vector<Block> programs(inputFiles.size());
 
-    if(!outputFile.empty()) {
-        std::ofstream os(outputFile);
+    {
+        ProfileScope phase("parse");
+        parallel_for(inputFiles.size(), jobs, [&](std::size_t i) {
+            programs[i] = parseSource(*includeGraph.sources[i]);
+        });
+        includeGraph.sources.clear();
+    }
 
-        if(!symbolFile.empty()) os << string_format("[map symbols %s]\n", symbolFile.c_str());
+    Code compiledCode;
+    std::vector<std::string> definitions;
 
-        os << "[bits 64]\n";
-        os << "DEFAULT REL\n";
+    ScopeTable scopes;
+    int rootFrameSize = 0;
+
+    {
+        ProfileScope phase("fold");
+        foldConstants(programs, signedComparisons);
+    }
 
-        writeQMacros(os);
+    {
+        ProfileScope phase("preprocess");
+        for(const Block &program: programs) preprocessFile(&rootCtx, program, scopes, rootVariables, definitions);
+        if(registerLocals) {
+            for(const Block &program: programs) allocateRegisters(program, scopes);
+        }
+        linkFrames(programs, scopes, rootVariables, rootCtx.linkedFunctions);
+        for(const Block &program: programs) rootFrameSize = std::max(rootFrameSize, layoutFunction(scopes, rootVariables, program));
+        for(const Block &program: programs) declareTopLevel(&rootCtx, program, scopes);
+    }
 
-        os << "arsenic:\n";
+    {
+        ProfileScope phase("compile");
 
-        os << string_format("enter %d, 0\n", stackSize(rootCtx.variables));
+        // Every file is compiled against its own copy of the root scope into its own buffers, which are joined in input order
+        std::vector<Code> fileCode(programs.size());
+        std::vector<std::vector<std::string>> fileDefinitions(programs.size());
 
-        os << "pushaq\n";
-        os << "pushfq\n";
+        parallel_for(programs.size(), jobs, [&](std::size_t i) {
+            Context fileCtx = rootCtx;
+            fileCtx.unit = i;
+            compileFile(&fileCtx, programs[i], scopes, fileCode[i], fileDefinitions[i]);
+        });
 
-        for (std::string line : compiledCode) os << line << "\n";
+        for(std::size_t i = 0; i < programs.size(); i++) {
+            compiledCode.append(fileCode[i]);
+            definitions.insert(definitions.end(), fileDefinitions[i].begin(), fileDefinitions[i].end());
+        }
+    }
 
-        os << "popfq\n";
-        os << "popaq\n";
+    {
+        ProfileScope phase("transform");
+        recordCounter("peephole rewrites", transform_code(compiledCode));
+        eliminate_saves(compiledCode);
+    }
 
-        os << "leave\n";
+    {
+        ProfileScope phase("emit");
 
-        os << "ret\n";
+        AsmWriter output;
+        emitAssembly(output, symbolFile, rootFrameSize, compiledCode, definitions);
 
-        for (std::string line : definitions) os << line << "\n";
+        if(!outputFile.empty() && !writeOutput(outputFile, output.buffer())) {
+            std::cerr << "Error: could not write " << outputFile << std::endl;
+            exit(1);
+        }
 
-        os.close();
+        if(!cacheDir.empty()) writeCache(cacheDir, cacheEntry, output.buffer());
     }
 
+    finishProfile(tracePath);
+
     return 0;
 }
@@ -0,0 +1,91 @@
+#include "cache.h"
+#include "utils.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef unsigned __int128 Hash;
+
+// 128 bit FNV-1a
+static Hash hashData(std::string_view data, Hash hash) {
+    const Hash prime = (static_cast<Hash>(1) << 88) | 0x13B;
+    for(char c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= prime;
+    }
+    return hash;
+}
+
+static Hash hashField(std::string_view data, Hash hash) {
+    // Prefixing each field with its length keeps adjacent fields from running together
+    std::string length = std::to_string(data.size()) + ":";
+    return hashData(data, hashData(length, hash));
+}
+
+std::string compilerIdentity(const char *argv0) {
+    std::filesystem::path executable;
+#ifdef _WIN32
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    if(length > 0 && length < MAX_PATH) executable = std::string(path, length);
+#else
+    std::error_code error;
+    executable = std::filesystem::read_symlink("/proc/self/exe", error);
+#endif
+    if(executable.empty()) executable = argv0;
+    std::error_code sizeError, timeError;
+    std::uintmax_t size = std::filesystem::file_size(executable, sizeError);
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(executable, timeError);
+    if(sizeError || timeError) return executable.string();
+    return string_format("%s:%llu:%lld", executable.string().c_str(), (unsigned long long)size, (long long)modified.time_since_epoch().count());
+}
+
+std::string cacheKey(const IncludeGraph &graph, const std::string &settings) {
+    const Hash offsetBasis = (static_cast<Hash>(0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL;
+    Hash hash = hashField(settings, offsetBasis);
+    for(std::size_t i = 0; i < graph.files.size(); i++) {
+        hash = hashField(graph.files[i], hash);
+        hash = hashField(graph.sources[i]->contents(), hash);
+    }
+    return string_format("%016llx%016llx", (unsigned long long)(hash >> 64), (unsigned long long)hash);
+}
+
+bool readCache(const std::string &cacheDir, const std::string &key, std::string &output) {
+    std::ifstream is(std::filesystem::path(cacheDir) / (key + ".asm"), std::ios::binary);
+    if(!is) return false;
+    std::ostringstream contents;
+    contents << is.rdbuf();
+    if(!is) return false;
+    output = contents.str();
+    return true;
+}
+
+void writeCache(const std::string &cacheDir, const std::string &key, const std::string &output) {
+    std::error_code error;
+    std::filesystem::create_directories(cacheDir, error);
+    std::filesystem::path entry = std::filesystem::path(cacheDir) / (key + ".asm");
+    // Write to a temporary file first so that a concurrent build never reads a partial entry
+    std::filesystem::path temp = entry;
+#ifdef _WIN32
+    temp += string_format(".%lu.tmp", (unsigned long)GetCurrentProcessId());
+#else
+    temp += string_format(".%ld.tmp", (long)getpid());
+#endif
+    std::ofstream os(temp, std::ios::binary);
+    os << output;
+    os.close();
+    if(!os) {
+        std::cerr << "Warning: cannot write to cache directory: " << cacheDir << std::endl;
+        std::filesystem::remove(temp, error);
+        return;
+    }
+    std::filesystem::rename(temp, entry, error);
+    if(error) std::filesystem::remove(temp, error);
+}
@@ -1,6 +1,8 @@
 #include "compiler.h"
+#include "profile.h"
+#include "regalloc.h"
 
-Struct_ findStruct(std::shared_ptr<Context> ctx, std::string name) {
+Struct_ findStruct(Context *ctx, std::string name) {
     do {
         if(ctx->structs.count(name)) return ctx->structs.find(name)->second;
         ctx = ctx->parent;
@@ -9,530 +11,675 @@ Struct_ findStruct(std::shared_ptr<Context> ctx, std::string name) {
     exit(1);
 }
 
-bool reg_match(std::string reg, char match) {
-    return std::regex_match(reg, std::regex(string_format("r?%c(l|h|x)", match)));
+bool reg_match(Register reg, Register match) {
+    return fullRegister(reg) == match;
 }
 
-int findVariableOffset(std::string var, std::map<std::string, Variable> variables) {
-    int offset = 0;
-    for(std::map<std::string, Variable>::iterator it = variables.begin(); it != variables.end(); it++) {
-        if(it->first == var) return offset;
-        offset += it->second.size;
+// Whether a variable takes space in the frame of the function declaring it
+static bool inFrame(const Variable &variable) {
+    return variable.storage == StorageClass::Stack || variable.storage == StorageClass::Ret;
+}
+
+int layoutFrame(std::map<std::string, Variable> &variables, int base) {
+    int offset = base;
+    for(std::pair<const std::string, Variable> &variable : variables) {
+        if(!inFrame(variable.second)) continue;
+        variable.second.offset = offset;
+        offset += variable.second.size;
     }
-    std::cerr << "Error: variable " << var << " not found" << std::endl;
-    exit(1);
+    return offset;
 }
 
-#define CHECK_SPECIAL_VARS(name) name == "args" ? ".arg" : name == "return" ? ".ret" : name
+// Places the variables of the blocks within block after base. Blocks which are never entered at the same time share space. Returns the end of the deepest one
+static int layoutBlocks(ScopeTable &scopes, const Block &block, int base) {
+    int end = base;
+    for(const Statement &statement : block) {
+        if(statement.type == StatementType::Function) layoutFunction(scopes, scopes.at(&statement.body), statement.body);
+        if(statement.type != StatementType::If && statement.type != StatementType::While) continue;
+        end = std::max(end, layoutBlocks(scopes, statement.body, layoutFrame(scopes.at(&statement.body), base)));
+        if(statement.hasElse) end = std::max(end, layoutBlocks(scopes, statement.elseBody, layoutFrame(scopes.at(&statement.elseBody), base)));
+    }
+    return end;
+}
 
-void resolve_argument_a(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string>& compiledCode,
-    int numParents = 0
-) {
-    std::smatch structMatch;
-    if(std::regex_match(var, structMatch, std::regex("\\s*\\(\\s*\\(\\s*struct \\s*(\\w+)\\s*\\)\\s*(\\w+)\\s*\\)\\.(\\w+)\\s*"))) {
-        std::string structName = structMatch[1];
-        std::string structVar = structMatch[2];
-        std::string structMember = structMatch[3];
-        Struct_ struct_ = findStruct(ctx, structName);
-        int memberOffset = struct_.members.find(structMember)->second.second;
-        resolve_argument_a(ctx, structVar, reg, compiledCode);
-        compiledCode.push_back(string_format("add %s, %d", reg.c_str(), memberOffset));
-        return;
+int layoutFunction(ScopeTable &scopes, std::map<std::string, Variable> &variables, const Block &body) {
+    return layoutBlocks(scopes, body, layoutFrame(variables, 0));
+}
+
+static int blockFrameSize(const ScopeTable &scopes, const Block &block) {
+    int size = 0;
+    for(const Statement &statement : block) {
+        if(statement.type != StatementType::If && statement.type != StatementType::While) continue;
+        size = std::max(size, frameSize(scopes, statement.body));
+        if(statement.hasElse) size = std::max(size, frameSize(scopes, statement.elseBody));
     }
-    var = CHECK_SPECIAL_VARS(var);
-    std::map<std::string, Variable>::iterator it = ctx->variables.find(var);
-    if(it == ctx->variables.end()) {
-        if(ctx->parent) {
-            resolve_argument_a(ctx->parent, var, reg, compiledCode, numParents + 1);
-        } else {
-            std::cerr << "Error: variable " << var << " not found" << std::endl;
-            exit(1);
-        }
-    } else {
-        it->second.getAddr(ctx, var, reg, compiledCode, numParents, findVariableOffset(var, ctx->variables));
+    return size;
+}
+
+int frameSize(const ScopeTable &scopes, const Block &body) {
+    int size = blockFrameSize(scopes, body);
+    for(const std::pair<const std::string, Variable> &variable : findScope(scopes, body)) {
+        if(inFrame(variable.second)) size = std::max(size, variable.second.offset + variable.second.size);
     }
+    return size;
 }
 
-void resolve_argument_i(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string> &compiledCode,
-    int numParents = 0
-) {
-    trim(var);
-    std::smatch match;
-    if(std::regex_match(var, match, std::regex("\\(\\s*\\(\\s*struct \\s*(.+)\\s*\\)\\s*(\\w+)\\s*\\)\\.(\\w+)"))) {
-        std::string structName = match[1];
-        std::string structVar = match[2];
-        std::string structMember = match[3];
-        Struct_ struct_ = findStruct(ctx, structName);
-        std::map<std::string, std::pair<int, int>>::iterator member = struct_.members.find(structMember);
-        int memberOffset = member->second.second;
-        resolve_argument_a(ctx, structVar, reg, compiledCode);
-        compiledCode.push_back(string_format("add %s, %d", reg.c_str(), memberOffset));
-        compiledCode.push_back(string_format("mov %s, [%s]", getSizedRegister(reg, member->second.first).c_str(), reg.c_str()));
-        if(member->second.first != 8) {
-            compiledCode.push_back(string_format("and %s, %s", reg.c_str(), getSizeMask(member->second.first).c_str()));
-        }
-        return;
+// The displacement of a variable from the frame pointer of the scope declaring it
+static std::int64_t frameOffset(const Variable &variable) {
+    return -(variable.offset + variable.size);
+}
+
+// Registers which carry the first arguments of a call. The caller also reserves home space for them above the arguments passed on the stack,
+// so that a callee which uses args can store them there and find every argument in one array
+static const Register argumentRegisters[] = {Register::rcx, Register::rdx, Register::r8, Register::r9};
+static const std::size_t argumentRegisterCount = sizeof(argumentRegisters) / sizeof(argumentRegisters[0]);
+
+// The displacement of the first argument from the frame pointer of the function receiving it, past the saved rbp and return address
+static const std::int64_t argumentsOffset = 16;
+
+// Creates a frame with room for size bytes of locals
+static void emitFrame(int size, Code &compiledCode) {
+    compiledCode.emit(Opcode::Push, registerOperand(Register::rbp));
+    compiledCode.emit(Opcode::Mov, registerOperand(Register::rbp), registerOperand(Register::rsp));
+    if(size != 0) compiledCode.emit(Opcode::Sub, registerOperand(Register::rsp), immediateOperand(size));
+}
+
+std::pair<int, int> findStructMember(Context *ctx, const Expr &var) {
+    Struct_ struct_ = findStruct(ctx, var.text);
+    std::map<std::string, std::pair<int, int>>::iterator member = struct_.members.find(var.member);
+    if(member == struct_.members.end()) {
+        std::cerr << "Error: struct " << var.text << " has no member " << var.member << std::endl;
+        exit(1);
     }
-    if(std::regex_match(var, match, std::regex("faddr\\(\\s*(\\w+)\\s*\\)"))) {
-        std::string functionName = match[1];
+    return member->second;
+}
 
-        std::shared_ptr<Context> searchCtx = ctx;
-        std::map<std::string, std::string>::iterator functionLabelIttr;
-        do {
-            if((functionLabelIttr = searchCtx->functions.find(functionName)) != searchCtx->functions.end()) break;
-            searchCtx = searchCtx->parent;
-        } while(searchCtx);
+// Finds the variable a name refers to from ctx, or returns nullptr
+const Variable *findVariable(Context *ctx, const std::string &name) {
+    for(Context *searchCtx = ctx; searchCtx; searchCtx = searchCtx->parent) {
+        std::map<std::string, Variable>::const_iterator it = searchCtx->variables->find(name);
+        if(it != searchCtx->variables->end()) return &it->second;
+    }
+    return nullptr;
+}
+
+static const std::string argVar(".arg"), retVar(".ret");
+
+#define CHECK_SPECIAL_VARS(name) name == "args" ? argVar : name == "return" ? retVar : name
 
-        std::string functionLabel = functionLabelIttr->second;
-        compiledCode.push_back(string_format("lea %s, [%s]", reg.c_str(), functionLabel.c_str()));
+void resolve_argument_a(
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
+) {
+    if(var.type == ExprType::StructMember) {
+        int memberOffset = findStructMember(ctx, var).second;
+        resolve_argument_a(ctx, var.operands[0], reg, compiledCode);
+        compiledCode.emit(Opcode::Add, registerOperand(reg), immediateOperand(memberOffset));
         return;
     }
-    if(('0' <= var[0] && var[0] <= '9') || var[0] == '\'') {
-        compiledCode.push_back(string_format("mov %s, %s", reg.c_str(), var.c_str()));
-        return;
+    if(var.type != ExprType::Variable) {
+        std::cerr << "Error: cannot take the address of an expression" << std::endl;
+        exit(1);
     }
-    if(var[0] == '(' || var[0] == '[') {
-        resolve_argument(ctx, var.substr(1, var.size() - 2), reg, compiledCode);
+    const std::string &name = CHECK_SPECIAL_VARS(var.text);
+    for(Context *searchCtx = ctx; searchCtx; searchCtx = searchCtx->parent) {
+        std::map<std::string, Variable>::const_iterator it = searchCtx->variables->find(name);
+        if(it == searchCtx->variables->end()) continue;
+        emitVariableAddress(ctx, searchCtx, name, it->second, reg, compiledCode);
         return;
     }
-    var = CHECK_SPECIAL_VARS(var);
-    std::map<std::string, Variable>::iterator it = ctx->variables.find(var);
-    if(it == ctx->variables.end()) {
-        if(ctx->parent) {
-            resolve_argument_i(ctx->parent, var, reg, compiledCode, numParents + 1);
-        } else {
-            std::cerr << "Error: variable " << var << " not found" << std::endl;
-            exit(1);
+    std::cerr << "Error: variable " << name << " not found" << std::endl;
+    exit(1);
+}
+
+void resolve_argument_i(
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
+) {
+    switch(var.type) {
+        case ExprType::StructMember: {
+            std::pair<int, int> member = findStructMember(ctx, var);
+            resolve_argument_a(ctx, var.operands[0], reg, compiledCode);
+            compiledCode.emit(Opcode::Add, registerOperand(reg), immediateOperand(member.second));
+            compiledCode.emit(Opcode::Mov, registerOperand(sizedRegister(reg, member.first)), memoryOperand(reg));
+            if(member.first != 8) {
+                compiledCode.emit(Opcode::And, registerOperand(reg), immediateOperand(getSizeMask(member.first)));
+            }
+            return;
         }
-    } else {
-        it->second.getValue(ctx, var, reg, compiledCode, numParents, findVariableOffset(var, ctx->variables), it->second.size);
-        if(it->second.size != 8) {
-            compiledCode.push_back(string_format("and %s, %s", reg.c_str(), getSizeMask(it->second.size).c_str()));
+        case ExprType::FunctionAddress: {
+            Context *searchCtx = ctx;
+            std::map<std::string, std::string>::iterator functionLabelIttr;
+            do {
+                if((functionLabelIttr = searchCtx->functions.find(var.text)) != searchCtx->functions.end()) break;
+                searchCtx = searchCtx->parent;
+            } while(searchCtx);
+
+            if(!searchCtx) {
+                std::cerr << "Error: function " << var.text << " not found" << std::endl;
+                exit(1);
+            }
+
+            if(ctx->root->linkedFunctions.count(std::make_pair(searchCtx->variables, var.text))) {
+                std::cerr << "Error: cannot take the address of function " << var.text << ", which uses variables of an enclosing scope" << std::endl;
+                exit(1);
+            }
+
+            std::string functionLabel = functionLabelIttr->second;
+            compiledCode.emit(Opcode::Lea, registerOperand(reg), compiledCode.symbolMemory(functionLabel));
+            return;
         }
+        case ExprType::Number:
+            compiledCode.emit(Opcode::Mov, registerOperand(reg), literalOperand(compiledCode, var.text));
+            return;
+        case ExprType::Variable: {
+            const std::string &name = CHECK_SPECIAL_VARS(var.text);
+            for(Context *searchCtx = ctx; searchCtx; searchCtx = searchCtx->parent) {
+                std::map<std::string, Variable>::const_iterator it = searchCtx->variables->find(name);
+                if(it == searchCtx->variables->end()) continue;
+                emitVariableValue(ctx, searchCtx, name, it->second, reg, compiledCode);
+                if(it->second.size != 8) {
+                    compiledCode.emit(Opcode::And, registerOperand(reg), immediateOperand(getSizeMask(it->second.size)));
+                }
+                return;
+            }
+            std::cerr << "Error: variable " << name << " not found" << std::endl;
+            exit(1);
+        }
+        case ExprType::String:
+        case ExprType::List:
+        case ExprType::Array:
+            std::cerr << "Error: strings, lists and arrays can only be allocated with '>'" << std::endl;
+            exit(1);
+        default:
+            resolve_argument(ctx, var, reg, compiledCode);
     }
 }
 
 #undef CHECK_SPECIAL_VARS
 
 void resolve_argument_p(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string> &compiledCode,
-    std::vector<std::string> &definitions,
-    int numParents = 0
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode,
+    std::vector<std::string> &definitions
 ) {
-    trim(var);
-    if(var[0] == '{') {
-        if(!reg_match(reg, 'a')) compiledCode.push_back("push rax");
-        std::string elems = var.substr(1, var.size() - 2);
-        int numElems = std::count(elems.begin(), elems.end(), ',') + 1;
-        compiledCode.push_back(string_format("mov rax, %d ", 8 * numElems));
-        compiledCode.push_back("call malloc");
-        for(int i = 0; i < numElems; i++) {
-            int elemLen = elems.find(',');
-            std::string elem = elems.substr(0, elemLen);
-            elems = elems.substr(elemLen + 1);
-            resolve_argument(ctx, elem, "rbx", compiledCode);
-            compiledCode.push_back(string_format("mov [rax+%d], rbx", 8 * i));
+    if(var.type == ExprType::List) {
+        if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+        compiledCode.emit(Opcode::Mov, registerOperand(Register::rax), immediateOperand(8 * var.operands.size()));
+        compiledCode.emit(Opcode::Call, compiledCode.symbolOperand("malloc"));
+        for(std::size_t i = 0; i < var.operands.size(); i++) {
+            resolve_argument(ctx, var.operands[i], Register::rbx, compiledCode);
+            compiledCode.emit(Opcode::Mov, memoryOperand(Register::rax, 8 * i), registerOperand(Register::rbx));
         }
-        if(!reg_match(reg, 'a')) {
-            compiledCode.push_back(string_format("mov %s, rax", reg.c_str()));
-            compiledCode.push_back("pop rax");
+        if(!reg_match(reg, Register::rax)) {
+            compiledCode.emit(Opcode::Mov, registerOperand(reg), registerOperand(Register::rax));
+            compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
         }
         return;
     }
-    if(var[0] == '"') {
-        int len = var.size() - 2 + 1;
+    if(var.type == ExprType::String) {
+        int len = var.text.size() - 2 + 1;
         int id = definitions.size();
-        std::string svar = string_format("arsenic_s%d", id);
-        definitions.push_back(string_format("%s db %s, 0", svar.c_str(), var.c_str()));
-        compiledCode.push_back("push rsi");
-        compiledCode.push_back("push rdi");
-        compiledCode.push_back("push rcx");
-        if(!reg_match(reg, 'a')) compiledCode.push_back("push rax");
-
-        compiledCode.push_back(string_format("mov rsi, %s", svar.c_str()));
-        compiledCode.push_back(string_format("mov rax, %d", len));
-        compiledCode.push_back("call malloc");
-        compiledCode.push_back("mov rdi, rax");
-        compiledCode.push_back(string_format("mov rcx, %d", len));
-
-        compiledCode.push_back("rep movsb");
-
-        compiledCode.push_back("pop rcx");
-        compiledCode.push_back("pop rdi");
-        compiledCode.push_back("pop rsi");
-
-        compiledCode.push_back(string_format("mov %s, rdi", reg.c_str()));
-        if(!reg_match(reg, 'a')) compiledCode.push_back("pop rax");
+        std::string svar = string_format("arsenic_u%d_s%d", ctx->unit, id);
+        definitions.push_back(string_format("%s db %s, 0", svar.c_str(), var.text.c_str()));
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rsi));
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rdi));
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rcx));
+        if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+
+        compiledCode.emit(Opcode::Mov, registerOperand(Register::rsi), compiledCode.symbolOperand(svar));
+        compiledCode.emit(Opcode::Mov, registerOperand(Register::rax), immediateOperand(len));
+        compiledCode.emit(Opcode::Call, compiledCode.symbolOperand("malloc"));
+        compiledCode.emit(Opcode::Mov, registerOperand(Register::rdi), registerOperand(Register::rax));
+        compiledCode.emit(Opcode::Mov, registerOperand(Register::rcx), immediateOperand(len));
+
+        compiledCode.emit(Opcode::RepMovsb);
+
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rcx));
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rdi));
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rsi));
+
+        compiledCode.emit(Opcode::Mov, registerOperand(reg), registerOperand(Register::rdi));
+        if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
         return;
     }
 
-    std::smatch emptyArrayMatch;
-    if(std::regex_match(var, emptyArrayMatch, std::regex("(.+){}"))) {
-        if(!reg_match(reg, 'a')) compiledCode.push_back("push rax");
-        resolve_argument(ctx, emptyArrayMatch[1], "rax", compiledCode);
-        compiledCode.push_back("call malloc");
-        compiledCode.push_back(string_format("mov %s, rax", reg.c_str()));
-        if(!reg_match(reg, 'a')) compiledCode.push_back("pop rax");
+    if(var.type == ExprType::Array) {
+        if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+        resolve_argument(ctx, var.operands[0], Register::rax, compiledCode);
+        compiledCode.emit(Opcode::Call, compiledCode.symbolOperand("malloc"));
+        compiledCode.emit(Opcode::Mov, registerOperand(reg), registerOperand(Register::rax));
+        if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
         return;
     }
 
-    if(!reg_match(reg, 'a')) compiledCode.push_back("push rax");
-    compiledCode.push_back("mov rax, 8");
-    compiledCode.push_back("call malloc");
-    compiledCode.push_back("push rbx");
-    resolve_argument(ctx, var, "rbx", compiledCode);
-    compiledCode.push_back("mov [rax], rbx");
-    compiledCode.push_back("pop rbx");
+    if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+    compiledCode.emit(Opcode::Mov, registerOperand(Register::rax), immediateOperand(8));
+    compiledCode.emit(Opcode::Call, compiledCode.symbolOperand("malloc"));
+    compiledCode.emit(Opcode::Push, registerOperand(Register::rbx));
+    resolve_argument(ctx, var, Register::rbx, compiledCode);
+    compiledCode.emit(Opcode::Mov, memoryOperand(Register::rax), registerOperand(Register::rbx));
+    compiledCode.emit(Opcode::Pop, registerOperand(Register::rbx));
 
-    if(!reg_match(reg, 'a')) {
-        compiledCode.push_back(string_format("mov %s, rax", reg.c_str()));
-        compiledCode.push_back("pop rax");
+    if(!reg_match(reg, Register::rax)) {
+        compiledCode.emit(Opcode::Mov, registerOperand(reg), registerOperand(Register::rax));
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
     }
 }
 
-bool resolve_argument_o(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::string operation,
-    std::function<void(std::vector<std::string>&)> printAsm,
-    std::vector<std::string> &compiledCode
-) {
-    trim(var);
-    std::size_t idx;
-    std::string scanVar = var;
-    if(ends_with(scanVar, "++") || ends_with(scanVar, "--")) {
-        scanVar = scanVar.substr(0, scanVar.size() - 2);
-    }
-    if(scanVar.rfind("++", 0) == 0 || scanVar.rfind("--", 0) == 0) {
-        scanVar = scanVar.substr(2);
-        idx = find_not_in_brackets(scanVar, operation) + 2;
-    } else {
-        idx = find_not_in_brackets(scanVar, operation);
-    }
-    if(idx == std::string::npos) return false;
-    std::string left = var.substr(0, idx);
-    std::string right = var.substr(idx + operation.size());
-    if(!reg_match(reg, 'a')) compiledCode.push_back("push rax");
-    if(!reg_match(reg, 'b')) compiledCode.push_back("push rbx");
-    resolve_argument(ctx, left, "rax", compiledCode);
-    resolve_argument(ctx, right, "rbx", compiledCode);
-    printAsm(compiledCode);
-    compiledCode.push_back(string_format("mov %s, rax", reg.c_str()));
-    if(!reg_match(reg, 'b')) compiledCode.push_back("pop rbx");
-    if(!reg_match(reg, 'a')) compiledCode.push_back("pop rax");
-    return true;
+bool isComparison(const std::string &operation) {
+    return operation == "==" || operation == "!=" || operation == "<" || operation == "<=" || operation == ">" || operation == ">=";
 }
 
-void resolve_argument(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string> &compiledCode
-) {
-    trim(var);
+// The setcc instruction which sets a byte to the result of a comparison of the operands of a cmp
+Opcode comparisonOpcode(const std::string &operation, bool signedComparison) {
+    if(operation == "==") return Opcode::Sete;
+    if(operation == "!=") return Opcode::Setne;
+    if(operation == "<") return signedComparison ? Opcode::Setl : Opcode::Setb;
+    if(operation == "<=") return signedComparison ? Opcode::Setle : Opcode::Setbe;
+    if(operation == ">") return signedComparison ? Opcode::Setg : Opcode::Seta;
+    return signedComparison ? Opcode::Setge : Opcode::Setae;
+}
 
-    // Grouping
+// The comparison which is true exactly when operation is false
+std::string invertComparison(const std::string &operation) {
+    if(operation == "==") return "!=";
+    if(operation == "!=") return "==";
+    if(operation == "<") return ">=";
+    if(operation == "<=") return ">";
+    if(operation == ">") return "<=";
+    return "<";
+}
 
-    #define PARSE_GROUPING(charsBefore, charsAfter) \
-        resolve_argument(ctx, var.substr(charsBefore, var.size() - (charsAfter + charsBefore)), reg.c_str(), compiledCode); \
-        if(var[0] == '[') compiledCode.push_back(string_format("mov %s, [%s]", reg.c_str(), reg.c_str()));
+bool isZero(const Expr &expr) {
+    std::int64_t value;
+    return expr.type == ExprType::Number && parseImmediate(expr.text, value) && value == 0;
+}
 
-    // Postfix
+// Sets the flags from condition, which is compared directly with cmp or test rather than being materialized. Returns the jump which is taken when
+// it evaluates to jumpWhen
+static Opcode compileComparison(Context *ctx, const Expr &condition, bool jumpWhen, Code &compiledCode) {
+    Operand rax = registerOperand(Register::rax), rbx = registerOperand(Register::rbx);
+    Opcode jumpIfNonzero = jumpWhen ? Opcode::Jnz : Opcode::Jz;
+    if(condition.type == ExprType::Binary && isComparison(condition.text)) {
+        const Expr &lhs = condition.operands[0], &rhs = condition.operands[1];
+        resolve_argument(ctx, lhs, Register::rax, compiledCode);
+        std::int64_t value;
+        if(isZero(rhs) && (condition.text == "==" || condition.text == "!=")) {
+            compiledCode.emit(Opcode::Test, rax, rax);
+        } else if(rhs.type == ExprType::Number && parseImmediate(rhs.text, value) && INT32_MIN <= value && value <= INT32_MAX) {
+            compiledCode.emit(Opcode::Cmp, rax, immediateOperand(value));
+        } else {
+            resolve_argument(ctx, rhs, Register::rbx, compiledCode);
+            compiledCode.emit(Opcode::Cmp, rax, rbx);
+        }
+        const std::string &comparison = jumpWhen ? condition.text : invertComparison(condition.text);
+        return jumpForSet(comparisonOpcode(comparison, ctx->root->signedComparisons));
+    }
+    if(condition.type == ExprType::Binary && condition.text == "&") {
+        resolve_argument(ctx, condition.operands[0], Register::rax, compiledCode);
+        resolve_argument(ctx, condition.operands[1], Register::rbx, compiledCode);
+        compiledCode.emit(Opcode::Test, rax, rbx);
+        return jumpIfNonzero;
+    }
+    resolve_argument(ctx, condition, Register::rax, compiledCode);
+    compiledCode.emit(Opcode::Test, rax, rax);
+    return jumpIfNonzero;
+}
 
-    if(ends_with(var, "++") || ends_with(var, "--")) {
-        PARSE_GROUPING(0, 2);
-        if(ends_with(var, "++")) compiledCode.push_back(string_format("inc %s", reg.c_str()));
-        else compiledCode.push_back(string_format("dec %s", reg.c_str()));
+// Emits a jump to label which is taken when condition evaluates to jumpWhen. Like other statements it preserves every register
+void compileCondition(Context *ctx, const Expr &condition, const std::string &label, bool jumpWhen, Code &compiledCode) {
+    Operand rax = registerOperand(Register::rax), rbx = registerOperand(Register::rbx);
+    Operand target = compiledCode.symbolOperand(label);
+    std::int64_t constant;
+    if(condition.type == ExprType::Number && parseImmediate(condition.text, constant)) {
+        // Left behind by constant folding
+        if((constant != 0) == jumpWhen) compiledCode.emit(Opcode::Jmp, target);
         return;
     }
+    // pop leaves the flags alone, so the registers are restored between the comparison and the jump. eliminate_saves drops the pairs when
+    // nothing reads the registers afterwards
+    compiledCode.emit(Opcode::Push, rax);
+    compiledCode.emit(Opcode::Push, rbx);
+    Opcode jump = compileComparison(ctx, condition, jumpWhen, compiledCode);
+    compiledCode.emit(Opcode::Pop, rbx);
+    compiledCode.emit(Opcode::Pop, rax);
+    compiledCode.emit(jump, target);
+}
 
-    // Prefix
-
-    if(var.rfind("++", 0) == 0 || var.rfind("--", 0) == 0) {
-        if(((var[2] == '(' && var.back() == ')') || (var[2] == '[' && var.back() == ']')) && matchingBrackets(var.substr(2, var.size() - 4))) {
-            PARSE_GROUPING(3, 1);
-            if(var.rfind("++", 0) == 0) compiledCode.push_back(string_format("inc %s", reg.c_str()));
-            else compiledCode.push_back(string_format("dec %s", reg.c_str()));
-            return;
-        }
+// Applies a binary operator to rax and rbx, leaving the result in rax
+void compileOperation(Context *ctx, const std::string &operation, Code &compiledCode) {
+    Operand rax = registerOperand(Register::rax), rbx = registerOperand(Register::rbx);
+    if(operation == "|") {
+        compiledCode.emit(Opcode::Or, rax, rbx);
+    } else if(operation == "^") {
+        compiledCode.emit(Opcode::Xor, rax, rbx);
+    } else if(operation == "&") {
+        compiledCode.emit(Opcode::And, rax, rbx);
+    } else if(isComparison(operation)) {
+        compiledCode.emit(Opcode::Cmp, rax, rbx);
+        compiledCode.emit(comparisonOpcode(operation, ctx->root->signedComparisons), registerOperand(Register::al));
+        compiledCode.emit(Opcode::Movzx, rax, registerOperand(Register::al));
+    } else if(operation == ">>" || operation == "<<") {
+        // Variable shift counts must be in cl
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rcx));
+        compiledCode.emit(Opcode::Mov, registerOperand(Register::rcx), rbx);
+        compiledCode.emit(operation == ">>" ? Opcode::Shr : Opcode::Shl, rax, registerOperand(Register::cl));
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rcx));
+    } else if(operation == "-") {
+        compiledCode.emit(Opcode::Sub, rax, rbx);
+    } else if(operation == "+") {
+        compiledCode.emit(Opcode::Add, rax, rbx);
+    } else if(operation == "%") {
+        // div divides rdx:rax, and rdx may hold an argument
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rdx));
+        compiledCode.emit(Opcode::Xor, registerOperand(Register::rdx), registerOperand(Register::rdx));
+        compiledCode.emit(Opcode::Div, rbx);
+        compiledCode.emit(Opcode::Mov, rax, registerOperand(Register::rdx));
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rdx));
+    } else if(operation == "/") {
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rdx));
+        compiledCode.emit(Opcode::Xor, registerOperand(Register::rdx), registerOperand(Register::rdx));
+        compiledCode.emit(Opcode::Div, rbx);
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rdx));
+    } else if(operation == "*") {
+        compiledCode.emit(Opcode::Push, registerOperand(Register::rdx));
+        compiledCode.emit(Opcode::Mul, rbx);
+        compiledCode.emit(Opcode::Pop, registerOperand(Register::rdx));
     }
-    if(var[0] == '~' || var[0] == '!') {
-        if(((var[1] == '(' && var.back() == ')') || (var[1] == '[' && var.back() == ']')) && matchingBrackets(var.substr(1, var.size() - 3))) {
-            PARSE_GROUPING(2, 1);
-            string_format("not %s", reg.c_str());
-            return;
-        }
+}
+
+struct DivisionMagic {
+    std::uint64_t multiplier;
+    int shift;
+    bool add; // The multiplier needs 65 bits. Its low 64 bits are stored, and the dividend is added back after the multiply
+};
+
+// Finds the multiplier for dividing by a constant which is not a power of two (Hacker's Delight, chapter 10)
+static DivisionMagic divisionMagic(std::uint64_t divisor) {
+    int shift = 63 - __builtin_clzll(divisor);
+    unsigned __int128 numerator = static_cast<unsigned __int128>(1) << (64 + shift);
+    std::uint64_t multiplier = numerator / divisor, remainder = numerator % divisor;
+    if(divisor - remainder < (static_cast<std::uint64_t>(1) << shift)) return DivisionMagic{multiplier + 1, shift, false};
+    multiplier *= 2;
+    if(static_cast<unsigned __int128>(remainder) * 2 >= divisor) multiplier++;
+    return DivisionMagic{multiplier + 1, shift, true};
+}
+
+// Multiplies rax by a constant. Factors which do not fit in a sign extended imm32 are loaded into scratch
+static void compileMultiply(std::uint64_t factor, Register scratch, Code &compiledCode) {
+    Operand rax = registerOperand(Register::rax), temp = registerOperand(scratch);
+    std::int64_t value = static_cast<std::int64_t>(factor);
+    if(factor == 0) compiledCode.emit(Opcode::Xor, rax, rax);
+    else if((factor & (factor - 1)) == 0) {
+        if(factor > 1) compiledCode.emit(Opcode::Shl, rax, immediateOperand(__builtin_ctzll(factor)));
+    } else if(INT32_MIN <= value && value <= INT32_MAX) {
+        compiledCode.emit(Opcode::Imul, rax, immediateOperand(value));
+    } else {
+        compiledCode.emit(Opcode::Mov, temp, immediateOperand(value));
+        compiledCode.emit(Opcode::Imul, rax, temp);
     }
+}
 
-    if(((var[0] == '(' && var.back() == ')') || (var[0] == '[' && var.back() == ']')) && matchingBrackets(var.substr(1, var.size() - 2))) {
-        PARSE_GROUPING(1, 1);
+// Divides rax, or finds its remainder, by a constant other than 0. Clobbers rbx
+static void compileConstantDivision(const std::string &operation, std::uint64_t divisor, Code &compiledCode) {
+    Operand rax = registerOperand(Register::rax), rbx = registerOperand(Register::rbx), rdx = registerOperand(Register::rdx);
+    if((divisor & (divisor - 1)) == 0) {
+        int shift = __builtin_ctzll(divisor);
+        if(operation == "/") {
+            if(shift > 0) compiledCode.emit(Opcode::Shr, rax, immediateOperand(shift));
+        } else if(shift == 0) {
+            compiledCode.emit(Opcode::Xor, rax, rax);
+        } else if(shift < 32) {
+            compiledCode.emit(Opcode::And, rax, immediateOperand(divisor - 1));
+        } else {
+            // Wider masks do not fit in a sign extended imm32
+            compiledCode.emit(Opcode::Mov, rbx, immediateOperand(divisor - 1));
+            compiledCode.emit(Opcode::And, rax, rbx);
+        }
         return;
     }
+    // The quotient is the high half of dividend * magic, so rbx keeps the dividend and rdx receives the product
+    DivisionMagic magic = divisionMagic(divisor);
+    compiledCode.emit(Opcode::Push, rdx);
+    compiledCode.emit(Opcode::Mov, rbx, rax);
+    compiledCode.emit(Opcode::Mov, rax, immediateOperand(static_cast<std::int64_t>(magic.multiplier)));
+    compiledCode.emit(Opcode::Mul, rbx);
+    if(magic.add) {
+        compiledCode.emit(Opcode::Mov, rax, rbx);
+        compiledCode.emit(Opcode::Sub, rax, rdx);
+        compiledCode.emit(Opcode::Shr, rax, immediateOperand(1));
+        compiledCode.emit(Opcode::Add, rax, rdx);
+    } else {
+        compiledCode.emit(Opcode::Mov, rax, rdx);
+    }
+    if(magic.shift > 0) compiledCode.emit(Opcode::Shr, rax, immediateOperand(magic.shift));
+    if(operation == "%") {
+        // rbx still holds the dividend, so the quotient is multiplied back using rdx
+        compileMultiply(divisor, Register::rdx, compiledCode);
+        compiledCode.emit(Opcode::Sub, rbx, rax);
+        compiledCode.emit(Opcode::Mov, rax, rbx);
+    }
+    compiledCode.emit(Opcode::Pop, rdx);
+}
 
-    #undef PARSE_GROUPING
-
-    // List in order of reverse precedence
-
-    if(resolve_argument_o(ctx, var, reg, "|", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("or rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "^", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("xor rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "&", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("and rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "!=", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("cmp rax, rbx");
-        compiledCode.push_back("lahf");
-        compiledCode.push_back("shr rax, 14"); // 6 + 8 = 14
-        compiledCode.push_back("not rax");
-        compiledCode.push_back("and rax, 1");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "==", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("cmp rax, rbx");
-        compiledCode.push_back("lahf");
-        compiledCode.push_back("shr rax, 14"); // 6 + 8 = 14
-        compiledCode.push_back("and rax, 1");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, ">=", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("cmp rax, rbx");
-        compiledCode.push_back("lahf");
-        compiledCode.push_back("shr rax, 8");
-        compiledCode.push_back("mov rbx, rax");
-        compiledCode.push_back("shr rax, 6"); // 6 + 8 = 14
-        compiledCode.push_back("not rax");
-        compiledCode.push_back("and rax, 1");
-        compiledCode.push_back("and rbx, 1");
-        compiledCode.push_back("or rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "<=", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("cmp rax, rbx");
-        compiledCode.push_back("lahf");
-        compiledCode.push_back("shr rax, 8");
-        compiledCode.push_back("mov rbx, rax");
-        compiledCode.push_back("shr rax, 6"); // 6 + 8 = 14
-        compiledCode.push_back("and rax, 1");
-        compiledCode.push_back("and rbx, 1");
-        compiledCode.push_back("or rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, ">", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("cmp rax, rbx");
-        compiledCode.push_back("lahf");
-        compiledCode.push_back("shr rax, 8");
-        compiledCode.push_back("mov rbx, rax");
-        compiledCode.push_back("shr rax, 6"); // 6 + 8 = 14
-        compiledCode.push_back("not rax");
-        compiledCode.push_back("and rax, 1");
-        compiledCode.push_back("not rbx");
-        compiledCode.push_back("and rbx, 1");
-        compiledCode.push_back("and rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "<", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("cmp rax, rbx");
-        compiledCode.push_back("lahf");
-        compiledCode.push_back("shr rax, 8");
-        compiledCode.push_back("and rax, 1");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, ">>", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("shr rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "<<", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("shl rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "-", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("sub rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "+", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("add rax, rbx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "%", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("push rdx");
-        compiledCode.push_back("div rbx");
-        compiledCode.push_back("mov rax, rdx");
-        compiledCode.push_back("pop rdx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "/", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("push rdx");
-        compiledCode.push_back("div rbx");
-        compiledCode.push_back("pop rdx");
-    }, compiledCode)) return;
-
-    if(resolve_argument_o(ctx, var, reg, "*", [](std::vector<std::string> &compiledCode) {
-        compiledCode.push_back("push rdx");
-        compiledCode.push_back("mul rbx");
-        compiledCode.push_back("pop rdx");
-    }, compiledCode)) return;
-
-    if(var.rfind("++", 0) == 0 || var.rfind("--", 0) == 0) {
-        resolve_argument_i(ctx, var.substr(2), reg, compiledCode);
-        if(var.rfind("++", 0) == 0) compiledCode.push_back(string_format("inc %s", reg));
-        else compiledCode.push_back(string_format("dec %s", reg.c_str()));
-        return;
+void resolve_argument_o(
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
+) {
+    if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+    if(!reg_match(reg, Register::rbx)) compiledCode.emit(Opcode::Push, registerOperand(Register::rbx));
+    resolve_argument(ctx, var.operands[0], Register::rax, compiledCode);
+    const Expr &rhs = var.operands[1];
+    std::int64_t value;
+    bool constant = rhs.type == ExprType::Number && parseImmediate(rhs.text, value);
+    if(constant && var.text == "*") {
+        compileMultiply(value, Register::rbx, compiledCode);
+    } else if(constant && value != 0 && (var.text == "/" || var.text == "%")) {
+        compileConstantDivision(var.text, value, compiledCode);
+    } else {
+        resolve_argument(ctx, rhs, Register::rbx, compiledCode);
+        compileOperation(ctx, var.text, compiledCode);
     }
+    compiledCode.emit(Opcode::Mov, registerOperand(reg), registerOperand(Register::rax));
+    if(!reg_match(reg, Register::rbx)) compiledCode.emit(Opcode::Pop, registerOperand(Register::rbx));
+    if(!reg_match(reg, Register::rax)) compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
+}
 
-    if(ends_with(var, "++") || ends_with(var, "--")) {
-        resolve_argument_i(ctx, var.substr(0, var.size() - 2), reg, compiledCode);
-        if(ends_with(var, "++")) compiledCode.push_back(string_format("inc %s", reg));
-        else compiledCode.push_back(string_format("dec %s", reg.c_str()));
-        return;
+void resolve_argument(
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
+) {
+    switch(var.type) {
+        case ExprType::Dereference:
+            resolve_argument(ctx, var.operands[0], reg, compiledCode);
+            compiledCode.emit(Opcode::Mov, registerOperand(reg), memoryOperand(reg));
+            return;
+        case ExprType::Unary:
+        case ExprType::Postfix:
+            resolve_argument(ctx, var.operands[0], reg, compiledCode);
+            if(var.text == "++") compiledCode.emit(Opcode::Inc, registerOperand(reg));
+            else if(var.text == "--") compiledCode.emit(Opcode::Dec, registerOperand(reg));
+            else if(var.text == "~") compiledCode.emit(Opcode::Not, registerOperand(reg));
+            else if(var.text == "-") compiledCode.emit(Opcode::Neg, registerOperand(reg));
+            return;
+        case ExprType::Binary:
+            resolve_argument_o(ctx, var, reg, compiledCode);
+            return;
+        default:
+            resolve_argument_i(ctx, var, reg, compiledCode);
     }
+}
 
-    resolve_argument_i(ctx, var, reg, compiledCode);
+void discoverScopes(
+    Context *ctx,
+    const Block &block,
+    ScopeTable &scopes,
+    std::map<std::string, Variable> &globals,
+    std::vector<std::string> &definitions,
+    bool function
+) {
+    // Blocks share the argument and return slots of their function
+    std::map<std::string, Variable> variables = function ? defaultVars() : std::map<std::string, Variable>();
+    for(const Statement &statement : block) {
+        if(statement.type == StatementType::Const) {
+            globals.emplace(statement.name, constVar());
+            definitions.push_back(string_format("%s_v%s equ %s", ctx->name.c_str(), statement.name.c_str(), statement.value.c_str()));
+        } else if((statement.type == StatementType::Assign || statement.type == StatementType::Allocate) && !statement.size.empty()) {
+            int size = getVarSize(statement.size);
+            if(statement.global) {
+                globals.emplace(statement.target.text, globalVar(size));
+                definitions.push_back(string_format("%s_v%s %s 0", ctx->name.c_str(), statement.target.text.c_str(), getGlobalSize(size).c_str()));
+            } else {
+                variables.emplace(statement.target.text, var(size));
+            }
+        } else if(statement.type == StatementType::Function || statement.type == StatementType::If || statement.type == StatementType::While) {
+            discoverScopes(ctx, statement.body, scopes, globals, definitions, statement.type == StatementType::Function);
+            if(statement.hasElse) discoverScopes(ctx, statement.elseBody, scopes, globals, definitions, false);
+        }
+    }
+    scopes.emplace(&block, variables);
 }
 
-int calculateIndentation(std::string line)
-{
-    int indentation = 0;
-    for (char c : line)
-    {
-        if (c == ' ') indentation++;
-        else if (c == '\t') indentation += 4;
-        else break;
+const std::map<std::string, Variable> &findScope(const ScopeTable &scopes, const Block &block) {
+    ScopeTable::const_iterator it = scopes.find(&block);
+    if(it == scopes.end()) {
+        std::cerr << "Error: no scope was discovered for block" << std::endl;
+        exit(1);
     }
-    return indentation;
+    return it->second;
+}
+
+std::string getFunctionLabel(Context *ctx, std::string name) {
+    return string_format("%s_f%s", ctx->name.c_str(), string_replace(name, std::string("_"), std::string("__")).c_str());
 }
 
-std::map<std::string, Variable> preprocessFunction(
-    std::shared_ptr<Context> ctx,
-    int indentation,
-    std::function<std::unique_ptr<std::string>()> getLine,
-    std::ifstream &file
+// Registers the functions and structs a file declares at the top level, so that they are visible to every file
+void declareTopLevel(
+    Context *ctx,
+    const Block &program,
+    const ScopeTable &scopes
 ) {
-    std::map<std::string, Variable> variables = defaultVars();
-    int posBkp = file.tellg();
-    int functionIndentation = -1;
-
-    for(;;) {
-        std::unique_ptr<std::string> linePtr = getLine();
-        if(!linePtr) break;
-        std::string line = *linePtr;
-        if(trim_copy(line).empty()) continue;
-        if(indentation >= calculateIndentation(line)) break;
-        if(functionIndentation != -1 && functionIndentation < calculateIndentation(line)) continue;
-        functionIndentation = calculateIndentation(line);
-        trim(line);
-        std::smatch varMatch;
-        if(std::regex_match(line, varMatch, std::regex("(byte|word|dword|qword)\\s*([^\\s]+)\\s*[=>]\\s*.+"))) {
-            std::string type = varMatch[1];
-            std::string name = varMatch[2];
-            variables.emplace(name, var(name, getVarSize(type)));
+    Code compiledCode;
+    std::vector<std::string> definitions;
+    for(const Statement &statement : program) {
+        if(statement.type == StatementType::Function || (statement.type == StatementType::Asm && !statement.name.empty())) {
+            ctx->functions.emplace(statement.name, getFunctionLabel(ctx, statement.name));
+        } else if(statement.type == StatementType::Struct) {
+            compileLine(ctx, statement, scopes, compiledCode, definitions);
         }
     }
+}
 
-    file.clear();
-    file.seekg(posBkp);
-    return variables;
+// Top-level scopes are compiled separately for each file, so their labels are qualified with the file's unit
+std::string scopeLabel(Context *ctx) {
+    if(ctx->parent) return ctx->name;
+    return string_format("%s_u%d", ctx->name.c_str(), ctx->unit);
 }
 
 std::string allocateLabel(
     std::string requestedName,
-    std::shared_ptr<Context> ctx
+    Context *ctx
 ) {
     int i = 0;
     while(ctx->functions.count(requestedName + std::to_string(i))) i++;
-    return requestedName + std::to_string(i);
-}
-
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int)> getArgAddr =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset) {
-        compiledCode.push_back(string_format("mov %s, rbp", reg.c_str()));
-        compiledCode.push_back(string_format("sub %s, %d", reg.c_str(),  8 * (ctx->depth + 2)));
-    };
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int, int)> getArgValue =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset, int size) {
-        compiledCode.push_back(string_format("mov %s, [rbp-%d]", reg.c_str(),  8 * (ctx->depth + 2)));
-    };
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int)> getRetAddr =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset) {
-        compiledCode.push_back(string_format("mov %s, [rbp-%d]", reg.c_str(), 8 * ctx->depth));
-        compiledCode.push_back(string_format("sub %s, rbp-%d", reg.c_str(), 8 * (ctx->depth + 1 + 1)));
-    };
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int, int)> getRetValue =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset, int size) {
-        compiledCode.push_back(string_format("mov %s, [rbp-%d]", reg.c_str(), 8 * (ctx->depth + 2 + 1)));
-    };
+    std::string label = requestedName + std::to_string(i);
+    ctx->functions.emplace(label, label);
+    return label;
+}
 
 std::map<std::string, Variable> defaultVars() {
     std::map<std::string, Variable> vars;
-    vars.emplace(".arg", Variable{".arg", getArgAddr, getArgValue, 8});
-    vars.emplace(".ret", Variable{".ret", getRetAddr, getRetValue, 8});
+    vars.emplace(".arg", Variable{StorageClass::Arg, 8});
+    vars.emplace(".ret", Variable{StorageClass::Ret, 8});
     return vars;
 }
 
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int)> getDefaultAddr =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset) {
-        if(numParents != 0) {
-            compiledCode.push_back(string_format("mov %s, [rbp-%d]", reg.c_str(), 8 * (ctx->depth + 1)));
-        } else {
-            compiledCode.push_back(string_format("mov %s, rbp", reg.c_str()));
-        }
-        compiledCode.push_back(string_format("sub %s, %d", reg.c_str(),  8 * (ctx->depth + 2) + offset));
-    };
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int, int)> getDefaultValue =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset, int size) {
-        if(numParents != 0) {
-            compiledCode.push_back(string_format("mov %s, [rbp-%d]", reg.c_str(), 8 * (ctx->depth + 1)));
-            compiledCode.push_back(string_format("mov %s, [%s-%d]", getSizedRegister(reg.c_str(), size).c_str(), reg.c_str(), 8 * (ctx->depth + 2) + offset));
-        } else {
-            compiledCode.push_back(string_format("mov %s, [rbp-%d]", getSizedRegister(reg.c_str(), size).c_str(), 8 * (ctx->depth + 2) + offset));
-        }
-    };
+Variable var(int size) {
+    return Variable{StorageClass::Stack, size};
+}
 
-Variable var(std::string name, int size) {
-    return Variable{name, getDefaultAddr, getDefaultValue, size};
+Variable constVar() {
+    return Variable{StorageClass::Const, 8};
 }
 
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int)> getConstAddr =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset) {
-        compiledCode.push_back(string_format("mov %s, 0", reg.c_str()));
-    };
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int, int)> getConstValue =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset, int size) {
-        compiledCode.push_back(string_format("mov %s, %s_v%s", reg.c_str(), ctx->name.c_str(), var.c_str()));
-    };
+Variable globalVar(int size) {
+    return Variable{StorageClass::Global, size};
+}
 
-Variable constVar(std::string name) {
-    return Variable{name, getConstAddr, getConstValue, 8, false};
+Register emitFramePointer(Context *ctx, Context *owner, Register reg, Code &compiledCode) {
+    Register frame = Register::rbp;
+    for(Context *scope = ctx; scope != owner; scope = scope->parent) {
+        // Blocks share the frame of their function
+        if(!scope->frame) continue;
+        // Functions may be called from anywhere, so the frame enclosing them is the one their caller passed in
+        std::map<std::string, Variable>::const_iterator link = scope->variables->find(".link");
+        if(link == scope->variables->end()) {
+            std::cerr << "Error: function " << scope->name << " has no link to the frame of its enclosing scope" << std::endl;
+            exit(1);
+        }
+        compiledCode.emit(Opcode::Mov, registerOperand(reg), memoryOperand(frame, frameOffset(link->second)));
+        frame = reg;
+    }
+    return frame;
 }
 
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int)> getGlobalAddr =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset) {
-        compiledCode.push_back(string_format("lea %s, [%s_v%s]", reg.c_str(), ctx->name.c_str(), var.c_str()));
-    };
-std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int, int)> getGlobalValue =
-    [](std::shared_ptr<Context> ctx, std::string var, std::string reg, std::vector<std::string>& compiledCode, int numParents, int offset, int size) {
-        compiledCode.push_back(string_format("mov %s, [%s_v%s]", getSizedRegister(reg.c_str(), size).c_str(), ctx->name.c_str(), var.c_str()));
-    };
+void emitVariableAddress(Context *ctx, Context *owner, const std::string &name, const Variable &variable, Register reg, Code &compiledCode) {
+    switch(variable.storage) {
+        case StorageClass::Stack:
+        case StorageClass::Ret: {
+            Register frame = emitFramePointer(ctx, owner, reg, compiledCode);
+            compiledCode.emit(Opcode::Lea, registerOperand(reg), memoryOperand(frame, frameOffset(variable)));
+            return;
+        }
+        case StorageClass::Arg:
+            std::cerr << "Error: cannot take the address of args, which is not stored in the frame" << std::endl;
+            exit(1);
+        case StorageClass::Global:
+            compiledCode.emit(Opcode::Lea, registerOperand(reg), compiledCode.symbolMemory(owner->name + "_v" + name));
+            return;
+        case StorageClass::Const:
+            compiledCode.emit(Opcode::Mov, registerOperand(reg), immediateOperand(0));
+            return;
+        case StorageClass::Register:
+            std::cerr << "Error: cannot take the address of " << name << ", which is kept in a register" << std::endl;
+            exit(1);
+    }
+}
 
-Variable globalVar(std::string name, int size) {
-    return Variable{name, getGlobalAddr, getGlobalValue, size, false};
+void emitVariableValue(Context *ctx, Context *owner, const std::string &name, const Variable &variable, Register reg, Code &compiledCode) {
+    switch(variable.storage) {
+        case StorageClass::Stack:
+        case StorageClass::Ret: {
+            Register frame = emitFramePointer(ctx, owner, reg, compiledCode);
+            compiledCode.emit(Opcode::Mov, registerOperand(sizedRegister(reg, variable.size)), memoryOperand(frame, frameOffset(variable)));
+            return;
+        }
+        case StorageClass::Arg: {
+            Register frame = emitFramePointer(ctx, owner, reg, compiledCode);
+            compiledCode.emit(Opcode::Lea, registerOperand(reg), memoryOperand(frame, argumentsOffset));
+            return;
+        }
+        case StorageClass::Global:
+            compiledCode.emit(Opcode::Mov, registerOperand(sizedRegister(reg, variable.size)), compiledCode.symbolMemory(owner->name + "_v" + name));
+            return;
+        case StorageClass::Const:
+            compiledCode.emit(Opcode::Mov, registerOperand(reg), compiledCode.symbolOperand(owner->name + "_v" + name));
+            return;
+        case StorageClass::Register:
+            compiledCode.emit(Opcode::Mov, registerOperand(reg), registerOperand(variable.reg));
+            return;
+    }
 }
 
 int getVarSize(std::string varSize) {
@@ -555,340 +702,273 @@ std::string getGlobalSize(int varSize) {
     exit(1);
 }
 
-std::string getSizeMask(int size) {
+std::int64_t getSizeMask(int size) {
     switch(size) {
-        case 1: return "0xff";
-        case 2: return "0xffff";
-        case 4: return "0xffffffff";
-        case 8: return "0xffffffffffffffff";
+        case 1: return 0xff;
+        case 2: return 0xffff;
+        case 4: return 0xffffffff;
+        case 8: return -1;
     }
     std::cerr << "Invalid variable size: " << size << std::endl;
     exit(1);
 }
 
-int stackSize(std::map<std::string, Variable> vars) {
-    int stackSize = 0;
-    for(std::pair<std::string, Variable> var : vars) if(var.second.onStack) stackSize += var.second.size;
-    return stackSize;
+// The register named by an {expr, reg} or [expr, reg] substitution in an asm block
+Register asmRegister(const std::string &name) {
+    Register reg = parseRegister(name);
+    if(reg == Register::None) {
+        std::cerr << "Error: unknown register " << name << std::endl;
+        exit(1);
+    }
+    return reg;
 }
 
-std::string getSizedRegister(std::string reg, int size) {
-    if(size == 8) return reg;
-    if(std::regex_match(reg, std::regex("r[0-9]{1,2}"))) {
-        if(size == 1) return reg + "b";
-        if(size == 2) return reg + "w";
-        if(size == 4) return reg + "d";
+static bool usesArgs(const Expr &expr) {
+    if(expr.type == ExprType::Variable && expr.text == "args") return true;
+    for(const Expr &operand : expr.operands) {
+        if(usesArgs(operand)) return true;
     }
-    reg = reg.substr(1, reg.size() - 1);
-    if(size == 2) return reg;
-    if(size == 4) return "e" + reg;
-    if(size == 1) { if(reg[1] == 'x') return reg[0] + "l"; else return reg + "l"; }
-    std::cerr << "Cannot convert register " << reg << " to size " << size << std::endl;
-    exit(1);
+    return false;
 }
 
-void compileLine(
-    std::shared_ptr<Context> ctx,
-    std::string line,
-    std::function<std::unique_ptr<std::string>()> getLine,
-    std::vector<std::string>& compiledCode,
-    std::vector<std::string>& definitions,
-    std::ifstream &file
-) {
-    int indentation = calculateIndentation(line);
-    trim(line);
-    if(line.empty() || line == "pass") return;
-    std::smatch match;
-    if(std::regex_match(line, match, std::regex("asm\\s*(?:([^\\s]+)?\\s*):"))) {
-        std::string functionName, functionLabel;
-        if(match.size() > 1) {
-            functionName = match[1];
-            std::string functionLabel = string_format("%s_f%s", ctx->name.c_str(), string_replace(functionName, std::string("_"), std::string("__")).c_str());
-            ctx->functions.emplace(functionName, functionLabel);
-            compiledCode.push_back(string_format("jmp %s_e", functionLabel.c_str()));
-            compiledCode.push_back(string_format("%s:", functionLabel.c_str()));
+// Whether the code of a function, outside of the functions it declares, refers to args
+static bool usesArgs(const Block &block) {
+    for(const Statement &statement : block) {
+        if(statement.type == StatementType::Function) continue;
+        if(usesArgs(statement.target) || usesArgs(statement.expr)) return true;
+        for(const Expr &arg : statement.args) {
+            if(usesArgs(arg)) return true;
         }
-        for(;;) {
-            std::unique_ptr<std::string> linePtr = getLine();
-            if(!linePtr) break;
-            line = *linePtr.get();
-            if(trim_copy(line).empty()) continue;
-            if(indentation >= calculateIndentation(line)) break;
-            std::smatch match;
-            if(std::regex_search(line, match, std::regex("\\{(.*),\\s*(rax|rbx|rcx|rdx)}"))) {
-                resolve_argument(ctx, match[1], match[2], compiledCode);
-                std::regex_replace(line, std::regex("\\{.*,\\s*(rax|rbx|rcx|rdx)\\}"), "$1");
-            }
-            if(std::regex_search(line, match, std::regex("\\[(.*),\\s*(rax|rbx|rcx|rdx)]"))) {
-                resolve_argument_a(ctx, match[1], match[2], compiledCode);
-                std::regex_replace(line, std::regex("\\[[^\\[\\]]*,\\s*(rax|rbx|rcx|rdx)\\]"), "$1");
-            }
-            trim(line);
-            if(line == "O0") compiledCode.push_back(";arsenic_o0");
-            else if(line == "O1") compiledCode.push_back(";arsenic_o1");
-            else compiledCode.push_back(line);
+        for(const AsmLine &asmLine : statement.asmLines) {
+            if((!asmLine.valueReg.empty() && usesArgs(asmLine.valueExpr)) || (!asmLine.addrReg.empty() && usesArgs(asmLine.addrExpr))) return true;
         }
-        if(!functionLabel.empty()) compiledCode.push_back(string_format("%s_e:", functionLabel.c_str()));
-        if(file.good()) compileLine(ctx, line, getLine, compiledCode, definitions, file);
-        return;
+        if((statement.type == StatementType::If || statement.type == StatementType::While) && (usesArgs(statement.body) || usesArgs(statement.elseBody))) return true;
     }
-    if(std::regex_match(line, match, std::regex("(?:global)?\\s*(?:byte|word|dword|qword)?\\s*([^\\s]+)\\s*=\\s*(.+)"))) {
-        compiledCode.push_back("push rax");
-        compiledCode.push_back("push rbx");
-
-        resolve_argument_a(ctx, match[1], "rax", compiledCode);
-        resolve_argument(ctx, match[2], "rbx", compiledCode);
-
-        compiledCode.push_back("mov [rax], rbx");
+    return false;
+}
 
-        compiledCode.push_back("pop rbx");
-        compiledCode.push_back("pop rax");
+void compileReturn(Context *ctx, Code &compiledCode) {
+    Context *function = ctx;
+    while(!function->frame) function = function->parent;
+    if(function->parent == nullptr) {
+        compiledCode.emit(Opcode::Popfq);
+        compiledCode.emit(Opcode::Popaq);
+    }
+    // Saved registers sit just below the function's frame
+    for(std::size_t i = function->savedRegisters.size(); i-- > 0;) compiledCode.emit(Opcode::Pop, registerOperand(function->savedRegisters[i]));
+    compiledCode.emit(Opcode::Leave);
+    compiledCode.emit(Opcode::Ret);
+}
 
-        if(match[1] == "return") {
-            if(ctx->parent == nullptr) {
-                compiledCode.push_back("popfq");
-                compiledCode.push_back("popaq");
+void compileLine(
+    Context *ctx,
+    const Statement &statement,
+    const ScopeTable &scopes,
+    Code &compiledCode,
+    std::vector<std::string>& definitions
+) {
+    switch(statement.type) {
+        case StatementType::Asm: {
+            std::string functionLabel;
+            if(!statement.name.empty()) {
+                functionLabel = getFunctionLabel(ctx, statement.name);
+                ctx->functions.emplace(statement.name, functionLabel);
+                compiledCode.emit(Opcode::Jmp, compiledCode.symbolOperand(functionLabel + "_e"));
+                compiledCode.label(functionLabel);
             }
-            for(int i = 0; i < ctx->nestedLevel; i++) compiledCode.push_back("leave");
-            compiledCode.push_back("ret");
-        }
-        return;
-    }
-    if(std::regex_match(line, match, std::regex("(?:global)?\\s*(?:byte|word|dword|qword)?\\s*([^\\s]+)\\s*>\\s*(.+)"))) {
-        compiledCode.push_back("push rax");
-        compiledCode.push_back("push rbx");
-
-        resolve_argument_a(ctx, match[1], "rax", compiledCode);
-        resolve_argument_p(ctx, match[2], "rbx", compiledCode, definitions);
-
-        compiledCode.push_back("mov [rax], rbx");
-
-        compiledCode.push_back("pop rbx");
-        compiledCode.push_back("pop rax");
-
-        if(match[1] == "return") {
-            if(ctx->parent == nullptr) {
-                compiledCode.push_back("popfq");
-                compiledCode.push_back("popaq");
+            for(const AsmLine &asmLine : statement.asmLines) {
+                if(!asmLine.valueReg.empty()) resolve_argument(ctx, asmLine.valueExpr, asmRegister(asmLine.valueReg), compiledCode);
+                if(!asmLine.addrReg.empty()) resolve_argument_a(ctx, asmLine.addrExpr, asmRegister(asmLine.addrReg), compiledCode);
+                if(asmLine.text == "O0") compiledCode.emit(Opcode::OptimizeOff);
+                else if(asmLine.text == "O1") compiledCode.emit(Opcode::OptimizeOn);
+                else compiledCode.assembly(asmLine.text);
             }
-            for(int i = 0; i < ctx->nestedLevel; i++) compiledCode.push_back("leave");
-            compiledCode.push_back("ret");
+            if(!functionLabel.empty()) compiledCode.label(functionLabel + "_e");
+            return;
         }
-        return;
-    }
-    if(std::regex_match(line, match, std::regex("([^\\s]+)\\s*<\\s*(.+)"))) {
-        compiledCode.push_back("push rax");
-        compiledCode.push_back("push rbx");
-
-        resolve_argument_i(ctx, match[1], "rax", compiledCode);
-        resolve_argument(ctx, match[2], "rbx", compiledCode);
-
-        compiledCode.push_back("mov [rax], rbx");
-
-        compiledCode.push_back("pop rbx");
-        compiledCode.push_back("pop rax");
-        return;
-    }
+        case StatementType::Assign:
+        case StatementType::Allocate:
+        case StatementType::Store: {
+            Context *function = ctx;
+            while(!function->frame) function = function->parent;
+            // Functions return their value in rax. The root restores every register when it returns, so its value stays in its frame
+            if(statement.type != StatementType::Store && statement.target.type == ExprType::Variable && statement.target.text == "return" && function->parent != nullptr) {
+                if(statement.type == StatementType::Allocate) resolve_argument_p(ctx, statement.expr, Register::rax, compiledCode, definitions);
+                else resolve_argument(ctx, statement.expr, Register::rax, compiledCode);
+                compileReturn(ctx, compiledCode);
+                return;
+            }
 
-    if(std::regex_match(line, match, std::regex("([^\\s]+)\\s*:"))) {
-        std::string functionName = match[1];
-        std::string functionLabel = string_format("%s_f%s", ctx->name.c_str(), string_replace(functionName, std::string("_"), std::string("__")).c_str());
+            const Variable *target = statement.type != StatementType::Store && statement.target.type == ExprType::Variable ? findVariable(ctx, statement.target.text) : nullptr;
+            if(target != nullptr && target->storage == StorageClass::Register) {
+                compiledCode.emit(Opcode::Push, registerOperand(Register::rbx));
+                if(statement.type == StatementType::Allocate) resolve_argument_p(ctx, statement.expr, Register::rbx, compiledCode, definitions);
+                else resolve_argument(ctx, statement.expr, Register::rbx, compiledCode);
+                compiledCode.emit(Opcode::Mov, registerOperand(target->reg), registerOperand(Register::rbx));
+                compiledCode.emit(Opcode::Pop, registerOperand(Register::rbx));
+                return;
+            }
 
-        ctx->functions.emplace(functionName, functionLabel);
+            compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+            compiledCode.emit(Opcode::Push, registerOperand(Register::rbx));
 
-        std::map<std::string, Variable> functionVars = preprocessFunction(ctx, indentation, getLine, file);
+            if(statement.type == StatementType::Store) resolve_argument(ctx, statement.target, Register::rax, compiledCode);
+            else resolve_argument_a(ctx, statement.target, Register::rax, compiledCode);
+            if(statement.type == StatementType::Allocate) resolve_argument_p(ctx, statement.expr, Register::rbx, compiledCode, definitions);
+            else resolve_argument(ctx, statement.expr, Register::rbx, compiledCode);
 
-        std::shared_ptr<Context> nCtx = std::make_shared<Context>(Context{functionLabel, functionVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, ctx->depth + 1, 1});
+            compiledCode.emit(Opcode::Mov, memoryOperand(Register::rax), registerOperand(Register::rbx));
 
-        compiledCode.push_back(string_format("jmp %s_e", functionLabel.c_str()));
-        compiledCode.push_back(string_format("%s:", functionLabel.c_str()));
-        compiledCode.push_back(string_format("enter %d, %d", stackSize(functionVars), ctx->depth));
-        compiledCode.push_back(string_format("mov [rbp-%d], ebx", 8 * (ctx->depth + 2)));
-        for(;;) {
-            std::unique_ptr<std::string> linePtr = getLine();
-            if(!linePtr) break;
-            line = *linePtr.get();
-            if(trim_copy(line).empty()) continue;
-            if(indentation >= calculateIndentation(line)) break;
-            compileLine(nCtx, line, getLine, compiledCode, definitions, file);
-        }
-        if(compiledCode.back() != "ret") {
-            compiledCode.push_back("leave");
-            compiledCode.push_back("ret");
-        }
-        compiledCode.push_back(string_format("%s_e:", functionLabel.c_str()));
-        if(file.good()) compileLine(ctx, line, getLine, compiledCode, definitions, file);
-        return;
-    }
+            compiledCode.emit(Opcode::Pop, registerOperand(Register::rbx));
+            compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
 
-    if(line == "return") {
-        if(ctx->parent == nullptr) {
-            compiledCode.push_back("popfq");
-            compiledCode.push_back("popaq");
+            if(statement.type != StatementType::Store && statement.target.type == ExprType::Variable && statement.target.text == "return") compileReturn(ctx, compiledCode);
+            return;
         }
-        for(int i = 0; i < ctx->nestedLevel; i++) compiledCode.push_back("leave");
-        compiledCode.push_back("ret");
-        return;
-    }
+        case StatementType::Function: {
+            std::string functionLabel = getFunctionLabel(ctx, statement.name);
 
-    if(std::regex_match(line, match, std::regex("delete\\s+([^\\s]+)"))) {
-        compiledCode.push_back("push rax");
-        resolve_argument_i(ctx, match[1], "rax", compiledCode);
-        compiledCode.push_back("call free");
-        compiledCode.push_back("pop rax");
-        return;
-    }
+            ProfileScope span(functionLabel, "function");
 
-    if(std::regex_match(line, match, std::regex("if\\s+([^\\s].+)\\s*:"))) {
-        std::string ifLabel = allocateLabel(string_format("%s_cif", ctx->name.c_str()), ctx);
+            ctx->functions.emplace(statement.name, functionLabel);
 
-        std::map<std::string, Variable> ifVars = preprocessFunction(ctx, indentation, getLine, file);
+            const std::map<std::string, Variable> &functionVars = findScope(scopes, statement.body);
 
-        std::shared_ptr<Context> ifCtx = std::make_shared<Context>(Context{ifLabel, ifVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, ctx->depth + 1, ctx->nestedLevel + 1});
+            Context nCtx{functionLabel, &functionVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, true, ctx->unit, functionRegisters(scopes, statement.body)};
 
-        compiledCode.push_back(string_format("%s:", ifLabel.c_str()));
-        compiledCode.push_back("push rax");
-        resolve_argument(ctx, match[1], "rax", compiledCode);
-        compiledCode.push_back("cmp rax, 0");
-        compiledCode.push_back("pop rax");
-        compiledCode.push_back(string_format("jz %s", string_format("%s_cel", ifLabel.c_str())));
-        compiledCode.push_back(string_format("enter %d, %d", stackSize(ifVars), ctx->depth));
-        for(;;) {
-            std::unique_ptr<std::string> linePtr = getLine();
-            if(!linePtr) break;
-            line = *linePtr.get();
-            if(trim_copy(line).empty()) continue;
-            if(indentation >= calculateIndentation(line)) break;
-            compileLine(ifCtx, line, getLine, compiledCode, definitions, file);
-        }
-        compiledCode.push_back("leave");
-        if(std::regex_match(line, std::regex("else\\s*:"))) {
-            compiledCode.push_back(string_format("jmp %s_e:", ifLabel.c_str()));
-            compiledCode.push_back(string_format("%s_cel:", ifLabel.c_str()));
-
-            std::map<std::string, Variable> elseVars = preprocessFunction(ctx, indentation, getLine, file);
-
-            std::shared_ptr<Context> elseCtx = std::make_shared<Context>(Context{ifLabel, ifVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, ctx->depth + 1, ctx->nestedLevel + 1});
-
-            compiledCode.push_back(string_format("enter %d, %d", stackSize(elseVars), ctx->depth));
-            for(;;) {
-                std::unique_ptr<std::string> linePtr = getLine();
-                if(!linePtr) break;
-                line = *linePtr.get();
-                if(trim_copy(line).empty()) continue;
-                if(indentation >= calculateIndentation(line)) break;
-                compileLine(elseCtx, line, getLine, compiledCode, definitions, file);
+            compiledCode.emit(Opcode::Jmp, compiledCode.symbolOperand(functionLabel + "_e"));
+            compiledCode.label(functionLabel);
+            emitFrame(frameSize(scopes, statement.body), compiledCode);
+            if(usesArgs(statement.body)) {
+                for(std::size_t i = 0; i < argumentRegisterCount; i++) compiledCode.emit(Opcode::Mov, memoryOperand(Register::rbp, argumentsOffset + 8 * i), registerOperand(argumentRegisters[i]));
             }
-            compiledCode.push_back("leave");
-        } else compiledCode.push_back(string_format("%s_cel:", ifLabel.c_str()));
-        compiledCode.push_back(string_format("%s_e:", ifLabel.c_str()));
-        if(file.good()) compileLine(ctx, line, getLine, compiledCode, definitions, file);
-        return;
-    }
-
-    if(std::regex_match(line, match, std::regex("while\\s+([^\\s].+)\\s*:"))) {
-        std::string whileLabel = allocateLabel(string_format("%s_cwhile", ctx->name.c_str()), ctx);
-
-        std::map<std::string, Variable> whileVars = preprocessFunction(ctx, indentation, getLine, file);
-
-        std::shared_ptr<Context> nCtx = std::make_shared<Context>(Context{whileLabel, whileVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, ctx->depth + 1, ctx->nestedLevel + 1});
-
-        compiledCode.push_back(string_format("enter %d, %d", stackSize(whileVars), ctx->depth));
-        compiledCode.push_back(string_format("%s:", whileLabel.c_str()));
-        compiledCode.push_back("push rax");
-        resolve_argument(ctx, match[1], "rax", compiledCode);
-        compiledCode.push_back("cmp rax, 0");
-        compiledCode.push_back("pop rax");
-        compiledCode.push_back(string_format("jz %s", string_format("%s_e", whileLabel.c_str())));
-        for(;;) {
-            std::unique_ptr<std::string> linePtr = getLine();
-            if(!linePtr) break;
-            line = *linePtr.get();
-            if(trim_copy(line).empty()) continue;
-            if(indentation >= calculateIndentation(line)) break;
-            compileLine(nCtx, line, getLine, compiledCode, definitions, file);
-            compiledCode.push_back(string_format("jmp %s", whileLabel.c_str()));
+            std::map<std::string, Variable>::const_iterator link = functionVars.find(".link");
+            if(link != functionVars.end()) compiledCode.emit(Opcode::Mov, memoryOperand(Register::rbp, frameOffset(link->second)), registerOperand(Register::r10));
+            for(Register reg : nCtx.savedRegisters) compiledCode.emit(Opcode::Push, registerOperand(reg));
+            for(const Statement &bodyStatement : statement.body) compileLine(&nCtx, bodyStatement, scopes, compiledCode, definitions);
+            if(compiledCode.instructions.back().op != Opcode::Ret) compileReturn(&nCtx, compiledCode);
+            compiledCode.label(functionLabel + "_e");
+            return;
         }
-        compiledCode.push_back(string_format("%s_e:", whileLabel.c_str()));
-        compiledCode.push_back("leave");
-        if(file.good()) compileLine(ctx, line, getLine, compiledCode, definitions, file);
-        return;
-    }
+        case StatementType::Return:
+            compileReturn(ctx, compiledCode);
+            return;
+        case StatementType::Delete:
+            compiledCode.emit(Opcode::Push, registerOperand(Register::rax));
+            resolve_argument(ctx, statement.expr, Register::rax, compiledCode);
+            compiledCode.emit(Opcode::Call, compiledCode.symbolOperand("free"));
+            compiledCode.emit(Opcode::Pop, registerOperand(Register::rax));
+            return;
+        case StatementType::If: {
+            std::string ifLabel = allocateLabel(string_format("%s_cif", scopeLabel(ctx).c_str()), ctx);
 
-    if(std::regex_match(line, match, std::regex("([^\\s]+)\\s*\\((.*)\\)"))) {
-        std::string functionName = match[1];
+            const std::map<std::string, Variable> &ifVars = findScope(scopes, statement.body);
 
-        std::string functionLabel;
+            Context ifCtx{ifLabel, &ifVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, false, ctx->unit};
 
-        std::smatch varFuncMatch;
-        if(std::regex_match(functionName, varFuncMatch, std::regex("\\(\\s*\\(\\s*func\\s*\\)\\s*(.*)\\)"))) {
-            resolve_argument_i(ctx, varFuncMatch[1], "rdx", compiledCode);
-        } else {
-            std::shared_ptr<Context> searchCtx = ctx;
-            std::map<std::string, std::string>::iterator functionLabelIttr;
-            do {
-                if((functionLabelIttr = searchCtx->functions.find(functionName)) != searchCtx->functions.end()) break;
-                searchCtx = searchCtx->parent;
-            } while(searchCtx);
+            compiledCode.label(ifLabel);
+            compileCondition(ctx, statement.expr, ifLabel + "_cel", false, compiledCode);
+            for(const Statement &bodyStatement : statement.body) compileLine(&ifCtx, bodyStatement, scopes, compiledCode, definitions);
+            if(statement.hasElse) {
+                compiledCode.emit(Opcode::Jmp, compiledCode.symbolOperand(ifLabel + "_e"));
+                compiledCode.label(ifLabel + "_cel");
 
-            functionLabel = functionLabelIttr->second;
-        }
+                const std::map<std::string, Variable> &elseVars = findScope(scopes, statement.elseBody);
 
-        std::string rawArgs = match[2];
-
-        std::vector<std::string> args = split(rawArgs, ',');
-        if(args.size() > 0) {
-            std::transform(args.begin(), args.end(), args.begin(), [](std::string arg) {
-                return trim_copy(arg);
-            });
-            compiledCode.push_back(string_format("sub rsp, %d", 8 * args.size()));
-            compiledCode.push_back("mov rbx, rsp");
-            compiledCode.push_back("sub rbx, 4");
-            for(std::size_t i = 0; i < args.size(); i++) {
-                resolve_argument(ctx, args[i], "rax", compiledCode);
-                compiledCode.push_back(string_format("mov [rbx + %d], rax",  8 * (args.size() - i - 1)));
-            }
-        }
-        compiledCode.push_back(string_format("call %s", functionLabel.empty() ? "rdx" : functionLabel.c_str()));
-        if(args.size() > 0) compiledCode.push_back(string_format("add rsp, %d", 8 * args.size()));
-        return;
-    }
+                Context elseCtx{ifLabel + "_cel", &elseVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, false, ctx->unit};
 
-    if(line == "O0") {
-        compiledCode.push_back(";arsenic_o0");
-        return;
-    }
-    if(line == "O1") {
-        compiledCode.push_back(";arsenic_o1");
-        return;
-    }
-
-    if(line.rfind("struct ", 0) == 0) {
-        std::vector<std::string> tokens = split(line, ' ');
-
-        std::string structName = tokens[1];
-        Struct_ struct_;
+                for(const Statement &bodyStatement : statement.elseBody) compileLine(&elseCtx, bodyStatement, scopes, compiledCode, definitions);
+            } else compiledCode.label(ifLabel + "_cel");
+            compiledCode.label(ifLabel + "_e");
+            return;
+        }
+        case StatementType::While: {
+            std::string whileLabel = allocateLabel(string_format("%s_cwhile", scopeLabel(ctx).c_str()), ctx);
 
-        ctx->structs.emplace(structName, struct_);
+            const std::map<std::string, Variable> &whileVars = findScope(scopes, statement.body);
 
-        int size = 0;
+            Context nCtx{whileLabel, &whileVars, std::map<std::string, Struct_>(), std::map<std::string, std::string>(), ctx, ctx->root, false, ctx->unit};
 
-        for(std::size_t i = 2; i < tokens.size(); i += 2) {
-            std::string type = tokens[i];
-            std::string name = tokens[i+1];
+            // The loop is rotated, so the condition is checked once on entry and then at the bottom by the only branch back to the top
+            compileCondition(ctx, statement.expr, whileLabel + "_e", false, compiledCode);
+            compiledCode.label(whileLabel);
+            for(const Statement &bodyStatement : statement.body) compileLine(&nCtx, bodyStatement, scopes, compiledCode, definitions);
+            compileCondition(ctx, statement.expr, whileLabel, true, compiledCode);
+            compiledCode.label(whileLabel + "_e");
+            return;
+        }
+        case StatementType::Call: {
+            std::string functionName = statement.name;
+
+            std::string functionLabel;
+            Context *linkedCallee = nullptr; // The scope declaring the function, if it must be passed that scope's frame
+
+            if(!functionName.empty()) {
+                Context *searchCtx = ctx;
+                std::map<std::string, std::string>::iterator functionLabelIttr;
+                do {
+                    if((functionLabelIttr = searchCtx->functions.find(functionName)) != searchCtx->functions.end()) break;
+                    searchCtx = searchCtx->parent;
+                } while(searchCtx);
+
+                if(!searchCtx) {
+                    std::cerr << "Error: function " << functionName << " not found" << std::endl;
+                    exit(1);
+                }
+
+                functionLabel = functionLabelIttr->second;
+                if(ctx->root->linkedFunctions.count(std::make_pair(searchCtx->variables, functionName))) linkedCallee = searchCtx;
+            }
 
-            if(type == "struct") {
-                Struct_ innerStruct = findStruct(ctx, name);
-                struct_.members.emplace(name, std::pair<int, int>(innerStruct.size, size));
-                size += innerStruct.size;
-            } else {
-                int varSize = getVarSize(type);
-                struct_.members.emplace(name, std::pair<int, int>(varSize, size));
-                size += varSize;
+            // Arguments past the registers are stored above the home space. Expressions preserve every register but rax and rbx, so the
+            // registers can be filled in order once the stack arguments are done
+            const std::vector<Expr> &args = statement.args;
+            std::int64_t argumentSpace = 8 * std::max(args.size(), argumentRegisterCount);
+            compiledCode.emit(Opcode::Sub, registerOperand(Register::rsp), immediateOperand(argumentSpace));
+            for(std::size_t i = argumentRegisterCount; i < args.size(); i++) {
+                resolve_argument(ctx, args[i], Register::rax, compiledCode);
+                compiledCode.emit(Opcode::Mov, memoryOperand(Register::rsp, 8 * i), registerOperand(Register::rax));
+            }
+            for(std::size_t i = 0; i < args.size() && i < argumentRegisterCount; i++) resolve_argument(ctx, args[i], argumentRegisters[i], compiledCode);
+            if(functionName.empty()) resolve_argument(ctx, statement.expr, Register::rax, compiledCode);
+            if(linkedCallee != nullptr) {
+                Register frame = emitFramePointer(ctx, linkedCallee, Register::r10, compiledCode);
+                if(frame != Register::r10) compiledCode.emit(Opcode::Mov, registerOperand(Register::r10), registerOperand(frame));
             }
+            compiledCode.emit(Opcode::Call, functionLabel.empty() ? registerOperand(Register::rax) : compiledCode.symbolOperand(functionLabel));
+            compiledCode.emit(Opcode::Add, registerOperand(Register::rsp), immediateOperand(argumentSpace));
+            return;
         }
+        case StatementType::Optimize:
+            compiledCode.emit(statement.name == "O0" ? Opcode::OptimizeOff : Opcode::OptimizeOn);
+            return;
+        case StatementType::Struct: {
+            Struct_ struct_;
+
+            int size = 0;
+
+            for(const std::pair<std::string, std::string> &member : statement.members) {
+                std::string type = member.first;
+                std::string name = member.second;
+
+                if(type == "struct") {
+                    Struct_ innerStruct = findStruct(ctx, name);
+                    struct_.members.emplace(name, std::pair<int, int>(innerStruct.size, size));
+                    size += innerStruct.size;
+                } else {
+                    int varSize = getVarSize(type);
+                    struct_.members.emplace(name, std::pair<int, int>(varSize, size));
+                    size += varSize;
+                }
+            }
 
-        struct_.size = size;
-        return;
+            struct_.size = size;
+            ctx->structs.emplace(statement.name, struct_);
+            return;
+        }
+        case StatementType::Const:
+        case StatementType::Include:
+        case StatementType::Pass:
+            return;
     }
 }
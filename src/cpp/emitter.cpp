@@ -0,0 +1,103 @@
+#include "emitter.h"
+#include <charconv>
+#include <cstdio>
+
+AsmWriter::AsmWriter(std::size_t capacity) {
+    out.reserve(capacity);
+}
+
+void AsmWriter::text(std::string_view text) {
+    out.append(text);
+}
+
+void AsmWriter::line(std::string_view text) {
+    out.append(text);
+    out.push_back('\n');
+}
+
+void AsmWriter::number(std::int64_t value) {
+    char digits[24];
+    std::to_chars_result result;
+    if(-65536 <= value && value <= 65535) {
+        result = std::to_chars(digits, digits + sizeof(digits), value);
+    } else {
+        digits[0] = '0';
+        digits[1] = 'x';
+        result = std::to_chars(digits + 2, digits + sizeof(digits), static_cast<std::uint64_t>(value), 16);
+    }
+    out.append(digits, result.ptr);
+}
+
+void AsmWriter::operand(const Code &code, const Operand &operand) {
+    switch(operand.type) {
+        case OperandType::None:
+            return;
+        case OperandType::Register:
+            out.append(registerName(operand.reg));
+            return;
+        case OperandType::Immediate:
+            number(operand.value);
+            return;
+        case OperandType::Symbol:
+            out.append(code.symbols[operand.symbol]);
+            return;
+        case OperandType::Memory:
+            if(operand.size != 0) {
+                out.append(sizeName(operand.size));
+                out.push_back(' ');
+            }
+            out.push_back('[');
+            if(operand.reg != Register::None) out.append(registerName(operand.reg));
+            if(operand.symbol >= 0) {
+                if(operand.reg != Register::None) out.push_back('+');
+                out.append(code.symbols[operand.symbol]);
+            }
+            if(operand.value > 0 && (operand.reg != Register::None || operand.symbol >= 0)) out.push_back('+');
+            if(operand.value != 0 || (operand.reg == Register::None && operand.symbol < 0)) {
+                char digits[24];
+                out.append(digits, std::to_chars(digits, digits + sizeof(digits), operand.value).ptr);
+            }
+            out.push_back(']');
+            return;
+    }
+}
+
+void AsmWriter::instruction(const Code &code, const Instruction &instruction) {
+    switch(instruction.op) {
+        case Opcode::Label:
+            out.append(code.symbols[instruction.operands[0].symbol]);
+            out.append(":\n");
+            return;
+        case Opcode::Raw:
+            line(code.symbols[instruction.operands[0].symbol]);
+            return;
+        case Opcode::OptimizeOff:
+            line(";arsenic_o0");
+            return;
+        case Opcode::OptimizeOn:
+            line(";arsenic_o1");
+            return;
+        default:
+            break;
+    }
+    out.append(opcodeName(instruction.op));
+    for(int i = 0; i < 2 && instruction.operands[i].type != OperandType::None; i++) {
+        out.append(i == 0 ? " " : ", ");
+        operand(code, instruction.operands[i]);
+    }
+    out.push_back('\n');
+}
+
+bool writeOutput(const std::string &path, std::string_view contents) {
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if(file == nullptr) return false;
+    // The buffer is already large, so skip stdio's copy and hand it straight to the OS
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    const std::size_t chunk = 1 << 22;
+    bool ok = true;
+    for(std::size_t offset = 0; ok && offset < contents.size(); offset += chunk) {
+        std::size_t size = std::min(chunk, contents.size() - offset);
+        ok = std::fwrite(contents.data() + offset, 1, size, file) == size;
+    }
+    return std::fclose(file) == 0 && ok;
+}
@@ -0,0 +1,295 @@
+#include "fold.h"
+#include "compiler.h"
+#include <map>
+
+struct Binding {
+    int assignments = 0;
+    bool pinned = false; // Its address is taken, or it is not a local, so its value may change in ways the folder cannot see
+    bool known = false;
+    std::int64_t value = 0;
+    std::int64_t mask = -1;
+};
+
+// Keyed by the block which declares the variable, or nullptr for the root scope
+typedef std::map<std::pair<const Block*, std::string>, Binding> BindingMap;
+
+static bool constantValue(const Expr &expr, std::int64_t &value) {
+    return expr.type == ExprType::Number && parseImmediate(expr.text, value);
+}
+
+static Expr constantExpr(std::int64_t value) {
+    return Expr{ExprType::Number, std::to_string(value)};
+}
+
+// Applies an operator the same way the generated code would
+static bool evaluate(const std::string &operation, std::uint64_t a, std::uint64_t b, bool signedComparisons, std::int64_t &result) {
+    std::int64_t sa = static_cast<std::int64_t>(a), sb = static_cast<std::int64_t>(b);
+    std::uint64_t value;
+    if(operation == "|") value = a | b;
+    else if(operation == "^") value = a ^ b;
+    else if(operation == "&") value = a & b;
+    else if(operation == "==") value = a == b;
+    else if(operation == "!=") value = a != b;
+    else if(operation == "<") value = signedComparisons ? sa < sb : a < b;
+    else if(operation == "<=") value = signedComparisons ? sa <= sb : a <= b;
+    else if(operation == ">") value = signedComparisons ? sa > sb : a > b;
+    else if(operation == ">=") value = signedComparisons ? sa >= sb : a >= b;
+    else if(operation == "<<") value = a << (b & 63);
+    else if(operation == ">>") value = a >> (b & 63);
+    else if(operation == "-") value = a - b;
+    else if(operation == "+") value = a + b;
+    else if(operation == "*") value = a * b;
+    else if(operation == "/" && b != 0) value = a / b;
+    else if(operation == "%" && b != 0) value = a % b;
+    else return false;
+    result = static_cast<std::int64_t>(value);
+    return true;
+}
+
+// Whether removing a block would lose declarations which are visible outside of it
+static bool declaresGlobals(const Block &block) {
+    for(const Statement &statement : block) {
+        if(statement.type == StatementType::Const || statement.global) return true;
+        if(declaresGlobals(statement.body) || declaresGlobals(statement.elseBody)) return true;
+    }
+    return false;
+}
+
+static bool declaresLocal(const Statement &statement) {
+    return (statement.type == StatementType::Assign || statement.type == StatementType::Allocate) && !statement.size.empty() && !statement.global;
+}
+
+class Folder {
+public:
+    Folder(std::vector<Block> &programs, bool signedComparisons) : programs(programs), signedComparisons(signedComparisons) {}
+
+    void run() {
+        // Every file shares the root scope, which also holds the consts and globals declared anywhere
+        for(Block &program : programs) {
+            for(const Statement &statement : program) {
+                if(declaresLocal(statement)) declare(nullptr, statement.target.text, statement.size);
+            }
+            declareGlobals(program);
+        }
+        do {
+            changed = false;
+            for(BindingMap::value_type &binding : bindings) binding.second.assignments = 0;
+            rewriting = false;
+            for(Block &program : programs) block(program, false);
+            rewriting = true;
+            for(Block &program : programs) block(program, false);
+        } while(changed);
+    }
+
+private:
+    std::vector<Block> &programs;
+    bool signedComparisons;
+    BindingMap bindings;
+    std::vector<const Block*> chain;
+    bool rewriting = false, changed = false;
+
+    void declare(const Block *scope, const std::string &name, const std::string &size) {
+        Binding &binding = bindings[std::make_pair(scope, name)];
+        binding.mask = getSizeMask(getVarSize(size));
+    }
+
+    void declareGlobals(const Block &block) {
+        for(const Statement &statement : block) {
+            if(statement.type == StatementType::Const) {
+                std::pair<BindingMap::iterator, bool> inserted = bindings.emplace(std::make_pair(nullptr, statement.name), Binding());
+                Binding &binding = inserted.first->second;
+                std::int64_t value;
+                // A name declared twice is left alone
+                if(inserted.second && parseImmediate(trim_copy(statement.value), value)) {
+                    binding.known = true;
+                    binding.value = value;
+                } else {
+                    binding.known = false;
+                    binding.pinned = true;
+                }
+            } else if(statement.global) {
+                bindings[std::make_pair(nullptr, statement.target.text)].pinned = true;
+            }
+            declareGlobals(statement.body);
+            declareGlobals(statement.elseBody);
+        }
+    }
+
+    Binding *find(const std::string &name) {
+        if(name == "args" || name == "return") return nullptr;
+        for(std::size_t i = chain.size(); i-- > 0;) {
+            BindingMap::iterator it = bindings.find(std::make_pair(chain[i], name));
+            if(it != bindings.end()) return &it->second;
+        }
+        BindingMap::iterator it = bindings.find(std::make_pair(nullptr, name));
+        return it == bindings.end() ? nullptr : &it->second;
+    }
+
+    void block(Block &block, bool scoped) {
+        if(scoped) {
+            chain.push_back(&block);
+            if(!rewriting) {
+                for(const Statement &statement : block) {
+                    if(declaresLocal(statement)) declare(&block, statement.target.text, statement.size);
+                }
+            }
+        }
+        for(Statement &statement : block) this->statement(statement);
+        if(scoped) chain.pop_back();
+    }
+
+    void statement(Statement &statement) {
+        switch(statement.type) {
+            case StatementType::Asm:
+                for(AsmLine &asmLine : statement.asmLines) {
+                    if(!asmLine.valueReg.empty()) expr(asmLine.valueExpr);
+                    if(!asmLine.addrReg.empty()) address(asmLine.addrExpr);
+                }
+                return;
+            case StatementType::Assign:
+            case StatementType::Allocate: {
+                expr(statement.expr);
+                if(statement.target.type != ExprType::Variable) {
+                    address(statement.target);
+                    return;
+                }
+                Binding *binding = find(statement.target.text);
+                if(binding == nullptr) return;
+                if(!rewriting) {
+                    binding->assignments++;
+                    return;
+                }
+                std::int64_t value;
+                if(statement.type == StatementType::Assign && declaresLocal(statement) && binding->assignments == 1 && !binding->pinned && !binding->known && constantValue(statement.expr, value)) {
+                    binding->known = true;
+                    binding->value = value & binding->mask;
+                    changed = true;
+                }
+                return;
+            }
+            case StatementType::Store:
+            case StatementType::Delete:
+            case StatementType::Call:
+                expr(statement.target);
+                expr(statement.expr);
+                for(Expr &arg : statement.args) expr(arg);
+                return;
+            case StatementType::Function:
+                block(statement.body, true);
+                return;
+            case StatementType::If:
+            case StatementType::While: {
+                expr(statement.expr);
+                std::int64_t condition;
+                if(rewriting && constantValue(statement.expr, condition)) prune(statement, condition != 0);
+                if(statement.type == StatementType::Pass) return;
+                block(statement.body, true);
+                if(statement.hasElse) block(statement.elseBody, true);
+                return;
+            }
+            default:
+                return;
+        }
+    }
+
+    // Drops the bindings of the locals of a block and the blocks nested in it, so that nothing is found through its address once it is reused
+    void forget(const Block &block) {
+        BindingMap::iterator it = bindings.lower_bound(std::make_pair(&block, std::string()));
+        while(it != bindings.end() && it->first.first == &block) it = bindings.erase(it);
+        for(const Statement &statement : block) {
+            forget(statement.body);
+            forget(statement.elseBody);
+        }
+    }
+
+    // Removes the parts of an if or while whose condition is constant which can never run
+    void prune(Statement &statement, bool condition) {
+        if(statement.type == StatementType::While) {
+            if(!condition && !declaresGlobals(statement.body)) {
+                statement.type = StatementType::Pass;
+                changed = true;
+            }
+            return;
+        }
+        if(condition) {
+            if(statement.hasElse && !declaresGlobals(statement.elseBody)) {
+                forget(statement.elseBody);
+                statement.hasElse = false;
+                statement.elseBody.clear();
+                changed = true;
+            }
+        } else if(!declaresGlobals(statement.body)) {
+            if(statement.hasElse) {
+                // The else body takes over the address of the body, so neither may keep what was learned about its locals
+                forget(statement.body);
+                forget(statement.elseBody);
+                statement.body = std::move(statement.elseBody);
+                statement.elseBody.clear();
+                statement.hasElse = false;
+                statement.expr = constantExpr(1);
+            } else {
+                statement.type = StatementType::Pass;
+            }
+            changed = true;
+        }
+    }
+
+    // An expression whose address is taken, so the variable it names may be written through it
+    void address(Expr &expr) {
+        if(expr.type == ExprType::Variable) {
+            Binding *binding = find(expr.text);
+            if(binding != nullptr && !binding->pinned) {
+                binding->pinned = true;
+                binding->known = false;
+                changed = true;
+            }
+            return;
+        }
+        if(expr.type == ExprType::StructMember) {
+            address(expr.operands[0]);
+            return;
+        }
+        this->expr(expr);
+    }
+
+    void expr(Expr &expr) {
+        if(expr.type == ExprType::StructMember) {
+            address(expr.operands[0]);
+            return;
+        }
+        for(Expr &operand : expr.operands) this->expr(operand);
+        if(!rewriting) return;
+
+        std::int64_t a, b, result;
+        switch(expr.type) {
+            case ExprType::Variable: {
+                Binding *binding = find(expr.text);
+                if(binding == nullptr || !binding->known || binding->pinned) return;
+                expr = constantExpr(binding->value);
+                changed = true;
+                return;
+            }
+            case ExprType::Binary:
+                if(!constantValue(expr.operands[0], a) || !constantValue(expr.operands[1], b)) return;
+                if(!evaluate(expr.text, a, b, signedComparisons, result)) return;
+                break;
+            case ExprType::Unary:
+            case ExprType::Postfix:
+                if(!constantValue(expr.operands[0], a)) return;
+                if(expr.text == "++") result = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) + 1);
+                else if(expr.text == "--") result = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) - 1);
+                else if(expr.text == "~") result = ~a;
+                else if(expr.text == "-") result = static_cast<std::int64_t>(-static_cast<std::uint64_t>(a));
+                else return;
+                break;
+            default:
+                return;
+        }
+        expr = constantExpr(result);
+        changed = true;
+    }
+};
+
+void foldConstants(std::vector<Block> &programs, bool signedComparisons) {
+    Folder(programs, signedComparisons).run();
+}
@@ -0,0 +1,150 @@
+#include "frames.h"
+
+struct FunctionFrame {
+    int parent; // The enclosing function, or -1 for the root scope
+    const std::map<std::string, Variable> *declaringScope;
+    std::string name;
+    std::map<std::string, Variable> *variables;
+    bool linked = false;
+};
+
+struct FrameCall {
+    int caller, callee;
+    int owner; // The function whose scope declares the callee
+};
+
+struct FrameScope {
+    std::map<std::string, Variable> *variables;
+    int function;
+    std::map<std::string, int> functions; // Functions declared in the scope. Asm functions are -1, since they never need a link
+};
+
+class LinkFinder {
+public:
+    std::vector<FunctionFrame> functions;
+    std::vector<FrameCall> calls;
+
+    LinkFinder(ScopeTable &scopes) : scopes(scopes) {}
+
+    void root(const std::vector<Block> &programs, std::map<std::string, Variable> &rootVariables) {
+        chain.push_back(FrameScope{&rootVariables, -1});
+        for(const Block &program : programs) declareFunctions(program);
+        for(const Block &program : programs) {
+            for(const Statement &statement : program) this->statement(statement);
+        }
+        chain.pop_back();
+    }
+
+    // Marks every function from function up to, but not including, owner as needing a link
+    bool link(int function, int owner) {
+        bool changed = false;
+        for(; function != owner && function >= 0; function = functions[function].parent) {
+            if(!functions[function].linked) changed = true;
+            functions[function].linked = true;
+        }
+        return changed;
+    }
+
+private:
+    ScopeTable &scopes;
+    std::vector<FrameScope> chain;
+    std::map<const Statement*, int> functionIndex;
+
+    void declareFunctions(const Block &block) {
+        FrameScope &scope = chain.back();
+        for(const Statement &statement : block) {
+            if(statement.type == StatementType::Function) {
+                int index = functions.size();
+                functions.push_back(FunctionFrame{scope.function, scope.variables, statement.name, &scopes.at(&statement.body)});
+                functionIndex.emplace(&statement, index);
+                scope.functions.emplace(statement.name, index);
+            } else if(statement.type == StatementType::Asm && !statement.name.empty()) {
+                scope.functions.emplace(statement.name, -1);
+            }
+        }
+    }
+
+    void block(const Block &block, int function) {
+        chain.push_back(FrameScope{&scopes.at(&block), function});
+        declareFunctions(block);
+        for(const Statement &statement : block) this->statement(statement);
+        chain.pop_back();
+    }
+
+    void statement(const Statement &statement) {
+        switch(statement.type) {
+            case StatementType::Asm:
+                for(const AsmLine &asmLine : statement.asmLines) {
+                    if(!asmLine.valueReg.empty()) expr(asmLine.valueExpr);
+                    if(!asmLine.addrReg.empty()) expr(asmLine.addrExpr);
+                }
+                return;
+            case StatementType::Assign:
+            case StatementType::Allocate:
+            case StatementType::Store:
+            case StatementType::Delete:
+                expr(statement.target);
+                expr(statement.expr);
+                return;
+            case StatementType::Call:
+                expr(statement.expr);
+                for(const Expr &arg : statement.args) expr(arg);
+                if(!statement.name.empty()) call(statement.name);
+                return;
+            case StatementType::Function:
+                block(statement.body, functionIndex.at(&statement));
+                return;
+            case StatementType::If:
+            case StatementType::While:
+                expr(statement.expr);
+                block(statement.body, chain.back().function);
+                if(statement.hasElse) block(statement.elseBody, chain.back().function);
+                return;
+            default:
+                return;
+        }
+    }
+
+    void expr(const Expr &expr) {
+        if(expr.type == ExprType::Variable) reference(expr.text == "args" ? ".arg" : expr.text == "return" ? ".ret" : expr.text);
+        for(const Expr &operand : expr.operands) this->expr(operand);
+    }
+
+    void reference(const std::string &name) {
+        for(std::size_t i = chain.size(); i-- > 0;) {
+            std::map<std::string, Variable>::const_iterator variable = chain[i].variables->find(name);
+            if(variable == chain[i].variables->end()) continue;
+            if(variable->second.storage != StorageClass::Global && variable->second.storage != StorageClass::Const) link(chain.back().function, chain[i].function);
+            return;
+        }
+    }
+
+    void call(const std::string &name) {
+        for(std::size_t i = chain.size(); i-- > 0;) {
+            std::map<std::string, int>::const_iterator callee = chain[i].functions.find(name);
+            if(callee == chain[i].functions.end()) continue;
+            if(callee->second >= 0) calls.push_back(FrameCall{chain.back().function, callee->second, chain[i].function});
+            return;
+        }
+    }
+};
+
+void linkFrames(const std::vector<Block> &programs, ScopeTable &scopes, std::map<std::string, Variable> &rootVariables, LinkTable &links) {
+    LinkFinder finder(scopes);
+    finder.root(programs, rootVariables);
+
+    // A caller must find the frame a linked callee is passed, so it needs a link of its own if that frame is outside it
+    bool changed;
+    do {
+        changed = false;
+        for(const FrameCall &call : finder.calls) {
+            if(finder.functions[call.callee].linked && finder.link(call.caller, call.owner)) changed = true;
+        }
+    } while(changed);
+
+    for(FunctionFrame &function : finder.functions) {
+        if(!function.linked) continue;
+        function.variables->emplace(".link", var(8));
+        links.emplace(function.declaringScope, function.name);
+    }
+}
@@ -0,0 +1,74 @@
+#include "includes.h"
+#include "utils.h"
+#include <iostream>
+#include <set>
+
+void getIncludes(const SourceFile &source, std::vector<std::string> &includes)
+{
+    for(std::size_t i = 0; i < source.lineCount(); i++) {
+        std::string_view line = source.line(i);
+        std::size_t directive = line.find("#include");
+        if(directive == std::string_view::npos) continue;
+        std::size_t start = directive + 8;
+        std::size_t quote = line.find_first_not_of(" \t", start);
+        if(quote == start || quote == std::string_view::npos || line[quote] != '"') continue;
+        std::size_t end = line.rfind('"');
+        if(end == quote) continue;
+        includes.push_back(std::string(line.substr(quote + 1, end - quote - 1)));
+    }
+}
+
+static std::string resolveInclude(
+    const std::string &include,
+    const std::vector<std::filesystem::path> &includePath,
+    std::map<std::string, std::string> &resolved
+) {
+    std::map<std::string, std::string>::iterator it = resolved.find(include);
+    if(it != resolved.end()) return it->second;
+    for(const std::filesystem::path &dir: includePath) {
+        std::filesystem::path fullPath = dir / include;
+        if(std::filesystem::exists(fullPath)) return resolved.emplace(include, fullPath.lexically_normal().string()).first->second;
+    }
+    std::cerr << "Cannot find included file: " << include << std::endl;
+    exit(1);
+}
+
+IncludeGraph buildIncludeGraph(
+    const std::vector<std::string> &inputFiles,
+    const std::vector<std::filesystem::path> &includePath,
+    unsigned jobs
+) {
+    IncludeGraph graph;
+    std::set<std::string> visited;
+    std::map<std::string, std::string> resolved;
+
+    std::vector<std::string> level;
+    for(const std::string &file: inputFiles) {
+        std::string normalized = std::filesystem::path(file).lexically_normal().string();
+        if(visited.insert(normalized).second) level.push_back(normalized);
+    }
+
+    // Each level is loaded and scanned in parallel, new files are collected in order for the next one
+    while(!level.empty()) {
+        std::vector<std::shared_ptr<SourceFile>> sources(level.size());
+        std::vector<std::vector<std::string>> includes(level.size());
+
+        parallel_for(level.size(), jobs, [&](std::size_t i) {
+            sources[i] = loadSource(level[i]);
+            getIncludes(*sources[i], includes[i]);
+        });
+
+        std::vector<std::string> nextLevel;
+        for(std::size_t i = 0; i < level.size(); i++) {
+            graph.files.push_back(level[i]);
+            graph.sources.push_back(sources[i]);
+            for(const std::string &include: includes[i]) {
+                std::string file = resolveInclude(include, includePath, resolved);
+                if(visited.insert(file).second) nextLevel.push_back(file);
+            }
+        }
+        level = nextLevel;
+    }
+
+    return graph;
+}
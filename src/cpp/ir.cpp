@@ -0,0 +1,251 @@
+#include "ir.h"
+#include "lexer.h"
+#include <cstring>
+
+static const char *const opcodeNames[] = {
+    "mov", "movzx", "lea", "add", "sub", "mul", "imul", "div", "and", "or", "xor", "not", "neg", "inc", "dec", "shl", "shr", "cmp", "test",
+    "sete", "setne", "setb", "setbe", "seta", "setae", "setl", "setle", "setg", "setge",
+    "push", "pop", "call", "ret", "jmp", "jz", "jnz", "jb", "jbe", "ja", "jae", "jl", "jle", "jg", "jge", "enter", "leave", "lahf", "pushfq", "popfq", "pushaq", "popaq", "rep movsb"
+};
+
+static const char *const registerNames[] = {
+    "",
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+    "ax", "bx", "cx", "dx", "si", "di", "bp", "sp", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w",
+    "al", "bl", "cl", "dl", "sil", "dil", "bpl", "spl", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+    "ah", "bh", "ch", "dh"
+};
+
+static const char *const sizeNames[] = {"", "byte", "word", "", "dword", "", "", "", "qword"};
+
+std::int32_t Code::symbol(std::string_view name) {
+    std::unordered_map<std::string, std::int32_t>::iterator it = symbolIndex.find(std::string(name));
+    if(it != symbolIndex.end()) return it->second;
+    std::int32_t index = symbols.size();
+    symbols.emplace_back(name);
+    symbolIndex.emplace(symbols.back(), index);
+    return index;
+}
+
+void Code::emit(Opcode op, Operand dst, Operand src) {
+    instructions.push_back(Instruction{op, {dst, src}});
+}
+
+void Code::label(std::string_view name) {
+    emit(Opcode::Label, symbolOperand(name));
+}
+
+Operand Code::symbolOperand(std::string_view name) {
+    Operand operand;
+    operand.type = OperandType::Symbol;
+    operand.symbol = symbol(name);
+    return operand;
+}
+
+Operand Code::symbolMemory(std::string_view name, int size) {
+    Operand operand;
+    operand.type = OperandType::Memory;
+    operand.symbol = symbol(name);
+    operand.size = size;
+    return operand;
+}
+
+void Code::append(const Code &other) {
+    std::vector<std::int32_t> translation(other.symbols.size());
+    for(std::size_t i = 0; i < other.symbols.size(); i++) translation[i] = symbol(other.symbols[i]);
+    instructions.reserve(instructions.size() + other.instructions.size());
+    for(Instruction instruction : other.instructions) {
+        for(Operand &operand : instruction.operands) {
+            if(operand.symbol >= 0) operand.symbol = translation[operand.symbol];
+        }
+        instructions.push_back(instruction);
+    }
+}
+
+Operand registerOperand(Register reg) {
+    Operand operand;
+    operand.type = OperandType::Register;
+    operand.reg = reg;
+    return operand;
+}
+
+Operand immediateOperand(std::int64_t value) {
+    Operand operand;
+    operand.type = OperandType::Immediate;
+    operand.value = value;
+    return operand;
+}
+
+Operand memoryOperand(Register base, std::int64_t displacement, int size) {
+    Operand operand;
+    operand.type = OperandType::Memory;
+    operand.reg = base;
+    operand.value = displacement;
+    operand.size = size;
+    return operand;
+}
+
+const char *opcodeName(Opcode op) {
+    return opcodeNames[static_cast<int>(op)];
+}
+
+bool isConditionalJump(Opcode op) {
+    return Opcode::Jz <= op && op <= Opcode::Jge;
+}
+
+Opcode jumpForSet(Opcode set) {
+    return static_cast<Opcode>(static_cast<int>(Opcode::Jz) + static_cast<int>(set) - static_cast<int>(Opcode::Sete));
+}
+
+const char *sizeName(int size) {
+    return sizeNames[size];
+}
+
+Register parseRegister(std::string_view name) {
+    for(std::size_t i = 1; i < sizeof(registerNames) / sizeof(registerNames[0]); i++) {
+        if(name == registerNames[i]) return static_cast<Register>(i);
+    }
+    return Register::None;
+}
+
+const char *registerName(Register reg) {
+    return registerNames[static_cast<int>(reg)];
+}
+
+int registerSize(Register reg) {
+    int index = static_cast<int>(reg);
+    if(index == 0) return 0;
+    if(index <= 16) return 8;
+    if(index <= 32) return 4;
+    if(index <= 48) return 2;
+    return 1;
+}
+
+Register fullRegister(Register reg) {
+    int index = static_cast<int>(reg);
+    if(index == 0) return reg;
+    if(index > 64) return static_cast<Register>(index - 64);
+    return static_cast<Register>((index - 1) % 16 + 1);
+}
+
+Register sizedRegister(Register reg, int size) {
+    int index = static_cast<int>(fullRegister(reg));
+    switch(size) {
+        case 8: return static_cast<Register>(index);
+        case 4: return static_cast<Register>(index + 16);
+        case 2: return static_cast<Register>(index + 32);
+        case 1: return static_cast<Register>(index + 48);
+    }
+    return Register::None;
+}
+
+bool parseImmediate(std::string_view text, std::int64_t &value) {
+    if(text.empty()) return false;
+    if(text.size() >= 2 && (text[0] == '\'' || text[0] == '"') && text.back() == text[0]) {
+        std::string_view chars = text.substr(1, text.size() - 2);
+        if(chars.empty() || chars.size() > 8) return false;
+        std::uint64_t packed = 0;
+        for(std::size_t i = 0; i < chars.size(); i++) packed |= static_cast<std::uint64_t>(static_cast<unsigned char>(chars[i])) << (8 * i);
+        value = static_cast<std::int64_t>(packed);
+        return true;
+    }
+    bool negative = text[0] == '-';
+    if(negative) text.remove_prefix(1);
+    int base = 10;
+    if(text.size() > 2 && text[0] == '0') {
+        switch(text[1]) {
+            case 'x': case 'X': base = 16; break;
+            case 'b': case 'B': base = 2; break;
+            case 'o': case 'O': case 'q': case 'Q': base = 8; break;
+            case 'd': case 'D': base = 10; break;
+        }
+        if(!('0' <= text[1] && text[1] <= '9')) text.remove_prefix(2);
+    }
+    if(text.empty()) return false;
+    std::uint64_t result = 0;
+    for(char c : text) {
+        int digit;
+        if('0' <= c && c <= '9') digit = c - '0';
+        else if('a' <= c && c <= 'f') digit = c - 'a' + 10;
+        else if('A' <= c && c <= 'F') digit = c - 'A' + 10;
+        else return false;
+        if(digit >= base) return false;
+        if(result > (UINT64_MAX - digit) / base) return false;
+        result = result * base + digit;
+    }
+    if(base == 10 && result > static_cast<std::uint64_t>(INT64_MAX) + negative) return false;
+    value = static_cast<std::int64_t>(negative ? -result : result);
+    return true;
+}
+
+Operand literalOperand(Code &code, std::string_view text) {
+    std::int64_t value;
+    if(parseImmediate(text, value)) return immediateOperand(value);
+    return code.symbolOperand(text);
+}
+
+// Parses one operand of a line of user assembly from tokens[i], leaving i after it
+static bool parseOperand(Code &code, const std::vector<Token> &tokens, std::size_t &i, Operand &operand) {
+    if(i >= tokens.size()) return false;
+    const Token &token = tokens[i];
+    int size = 0;
+    if(token.type == TokenType::Identifier) {
+        for(int s : {1, 2, 4, 8}) if(token.text == sizeNames[s]) size = s;
+    }
+    if(size != 0) i++;
+    if(i < tokens.size() && isSymbol(tokens[i], "[")) {
+        i++;
+        if(i >= tokens.size() || tokens[i].type != TokenType::Identifier) return false;
+        Register base = parseRegister(tokens[i].text);
+        if(base == Register::None) operand = code.symbolMemory(tokens[i].text, size);
+        else operand = memoryOperand(base, 0, size);
+        i++;
+        if(base != Register::None && i + 1 < tokens.size() && (isSymbol(tokens[i], "+") || isSymbol(tokens[i], "-"))) {
+            std::int64_t displacement;
+            if(tokens[i + 1].type != TokenType::Number || !parseImmediate(tokens[i + 1].text, displacement)) return false;
+            operand.value = isSymbol(tokens[i], "-") ? -displacement : displacement;
+            i += 2;
+        }
+        if(i >= tokens.size() || !isSymbol(tokens[i], "]")) return false;
+        i++;
+        return true;
+    }
+    if(size != 0 || i >= tokens.size()) return false;
+    bool negative = isSymbol(tokens[i], "-");
+    if(negative) i++;
+    if(i >= tokens.size()) return false;
+    const Token &value = tokens[i++];
+    if(value.type == TokenType::Number || value.type == TokenType::Char || value.type == TokenType::String) {
+        std::int64_t immediate;
+        if(!parseImmediate(value.text, immediate)) return false;
+        operand = immediateOperand(negative ? -immediate : immediate);
+        return true;
+    }
+    if(negative || value.type != TokenType::Identifier) return false;
+    Register reg = parseRegister(value.text);
+    operand = reg == Register::None ? code.symbolOperand(value.text) : registerOperand(reg);
+    return true;
+}
+
+void Code::assembly(std::string_view text) {
+    std::vector<Token> tokens = tokenize(text);
+    if(!tokens.empty() && tokens[0].type == TokenType::Identifier) {
+        int op = -1;
+        for(std::size_t i = 0; i < sizeof(opcodeNames) / sizeof(opcodeNames[0]); i++) {
+            if(tokens[0].text == opcodeNames[i]) op = i;
+        }
+        Instruction instruction{static_cast<Opcode>(op), {}};
+        std::size_t i = 1, operandCount = 0;
+        bool valid = op >= 0;
+        while(valid && i < tokens.size()) {
+            if(operandCount == 2 || (operandCount == 1 && !isSymbol(tokens[i++], ","))) valid = false;
+            else valid = parseOperand(*this, tokens, i, instruction.operands[operandCount++]);
+        }
+        if(valid) {
+            instructions.push_back(instruction);
+            return;
+        }
+    }
+    emit(Opcode::Raw, symbolOperand(text));
+}
@@ -0,0 +1,58 @@
+#include "lexer.h"
+
+bool isToken(const Token &token, TokenType type, const std::string &text) {
+    return token.type == type && token.text == text;
+}
+
+bool isSymbol(const Token &token, const std::string &text) {
+    return isToken(token, TokenType::Symbol, text);
+}
+
+static inline bool isIdentifierChar(char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '_';
+}
+
+// Two-character symbols, everything else is a single character
+static const char *symbols[] = {
+    "++", "--", "<<", ">>", "<=", ">=", "==", "!=",
+};
+
+std::vector<Token> tokenize(std::string_view line) {
+    std::vector<Token> tokens;
+    std::size_t i = 0;
+    while(i < line.size()) {
+        char c = line[i];
+        if(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            i++;
+            continue;
+        }
+        std::size_t start = i;
+        if(isIdentifierChar(c)) {
+            while(i < line.size() && isIdentifierChar(line[i])) i++;
+            TokenType type = '0' <= c && c <= '9' ? TokenType::Number : TokenType::Identifier;
+            tokens.push_back(Token{type, std::string(line.substr(start, i - start)), start, i});
+            continue;
+        }
+        if(c == '"' || c == '\'') {
+            i++;
+            while(i < line.size() && line[i] != c) {
+                if(line[i] == '\\') i++;
+                i++;
+            }
+            if(i < line.size()) i++;
+            else i = line.size();
+            tokens.push_back(Token{c == '"' ? TokenType::String : TokenType::Char, std::string(line.substr(start, i - start)), start, i});
+            continue;
+        }
+        std::size_t len = 1;
+        for(const char *symbol : symbols) {
+            if(line.compare(i, 2, symbol) == 0) {
+                len = 2;
+                break;
+            }
+        }
+        i += len;
+        tokens.push_back(Token{TokenType::Symbol, std::string(line.substr(start, len)), start, i});
+    }
+    return tokens;
+}
@@ -0,0 +1,193 @@
+#include "liveness.h"
+#include <unordered_map>
+
+// rbp and rsp hold the frame and stack, so they are never dead
+static const RegisterSet pinnedRegisters = (1u << (static_cast<int>(Register::rbp) - 1)) | (1u << (static_cast<int>(Register::rsp) - 1));
+
+RegisterSet registerBit(Register reg) {
+    if(reg == Register::None) return 0;
+    return 1u << (static_cast<int>(fullRegister(reg)) - 1);
+}
+
+// Functions keep the frame, the stack and the registers which hold locals. Any other register may be overwritten by a call
+static const RegisterSet calleeSaved = pinnedRegisters | registerBit(Register::r12) | registerBit(Register::r13) | registerBit(Register::r14) | registerBit(Register::r15);
+
+// rax holds a function pointer or the size passed to malloc, rcx to r9 the arguments and r10 the static link
+static const RegisterSet callArguments = registerBit(Register::rax) | registerBit(Register::rcx) | registerBit(Register::rdx) | registerBit(Register::r8)
+    | registerBit(Register::r9) | registerBit(Register::r10) | registerBit(Register::rsp);
+
+static RegisterSet baseUse(const Operand &operand) {
+    if(operand.type == OperandType::Register || operand.type == OperandType::Memory) return registerBit(operand.reg);
+    return 0;
+}
+
+// A write to a register. Writes to 8 and 16 bit registers keep the rest of the register, so they also read it
+static void write(const Operand &operand, RegisterSet &uses, RegisterSet &defs) {
+    if(operand.type == OperandType::Memory) uses |= registerBit(operand.reg);
+    if(operand.type != OperandType::Register) return;
+    if(registerSize(operand.reg) < 4) uses |= registerBit(operand.reg);
+    defs |= registerBit(operand.reg);
+}
+
+void instructionEffects(const Instruction &instruction, RegisterSet &uses, RegisterSet &defs) {
+    const Operand &dst = instruction.operands[0], &src = instruction.operands[1];
+    RegisterSet stack = registerBit(Register::rsp);
+    uses = defs = 0;
+    switch(instruction.op) {
+        case Opcode::Mov:
+        case Opcode::Movzx:
+        case Opcode::Lea:
+            write(dst, uses, defs);
+            uses |= baseUse(src);
+            return;
+        case Opcode::Xor:
+        case Opcode::Sub:
+            // Zeroing a register does not depend on its value
+            if(dst.type == OperandType::Register && src.type == OperandType::Register && dst.reg == src.reg) {
+                write(dst, uses, defs);
+                return;
+            }
+            [[fallthrough]];
+        case Opcode::Add:
+        case Opcode::And:
+        case Opcode::Or:
+        case Opcode::Shl:
+        case Opcode::Shr:
+        case Opcode::Not:
+        case Opcode::Neg:
+        case Opcode::Inc:
+        case Opcode::Dec:
+            uses |= baseUse(dst) | baseUse(src);
+            write(dst, uses, defs);
+            return;
+        case Opcode::Cmp:
+        case Opcode::Test:
+            uses |= baseUse(dst) | baseUse(src);
+            return;
+        case Opcode::Sete:
+        case Opcode::Setne:
+        case Opcode::Setb:
+        case Opcode::Setbe:
+        case Opcode::Seta:
+        case Opcode::Setae:
+        case Opcode::Setl:
+        case Opcode::Setle:
+        case Opcode::Setg:
+        case Opcode::Setge:
+            write(dst, uses, defs);
+            return;
+        case Opcode::Imul:
+            if(src.type != OperandType::None) {
+                uses |= baseUse(dst) | baseUse(src);
+                write(dst, uses, defs);
+                return;
+            }
+            // The one operand form multiplies rax into rdx:rax like mul
+            [[fallthrough]];
+        case Opcode::Mul:
+        case Opcode::Div:
+            uses |= baseUse(dst) | registerBit(Register::rax) | registerBit(Register::rdx);
+            defs |= registerBit(Register::rax) | registerBit(Register::rdx);
+            return;
+        case Opcode::Push:
+            uses |= baseUse(dst) | stack;
+            defs |= stack;
+            return;
+        case Opcode::Pop:
+            uses |= stack;
+            defs |= stack;
+            write(dst, uses, defs);
+            return;
+        case Opcode::Jmp:
+        case Opcode::Jz:
+        case Opcode::Jnz:
+        case Opcode::Jb:
+        case Opcode::Jbe:
+        case Opcode::Ja:
+        case Opcode::Jae:
+        case Opcode::Jl:
+        case Opcode::Jle:
+        case Opcode::Jg:
+        case Opcode::Jge:
+            uses |= baseUse(dst);
+            return;
+        case Opcode::Call:
+            uses |= baseUse(dst) | callArguments;
+            defs |= allRegisters & ~calleeSaved;
+            return;
+        case Opcode::Ret:
+            // The root returns through popaq, which has already restored every register
+            uses |= registerBit(Register::rax) | calleeSaved;
+            return;
+        case Opcode::Raw:
+        case Opcode::Pushaq:
+            uses |= allRegisters;
+            return;
+        case Opcode::Popaq:
+            uses |= stack;
+            defs |= allRegisters;
+            return;
+        case Opcode::Enter:
+        case Opcode::Leave:
+            uses |= pinnedRegisters;
+            defs |= pinnedRegisters;
+            return;
+        case Opcode::Pushfq:
+        case Opcode::Popfq:
+            uses |= stack;
+            defs |= stack;
+            return;
+        case Opcode::Lahf:
+            uses |= registerBit(Register::rax);
+            defs |= registerBit(Register::rax);
+            return;
+        case Opcode::RepMovsb:
+            uses |= registerBit(Register::rsi) | registerBit(Register::rdi) | registerBit(Register::rcx);
+            defs |= registerBit(Register::rsi) | registerBit(Register::rdi) | registerBit(Register::rcx);
+            return;
+        case Opcode::Label:
+        case Opcode::OptimizeOff:
+        case Opcode::OptimizeOn:
+            return;
+    }
+}
+
+std::vector<BasicBlock> findBasicBlocks(const Code &code) {
+    const std::vector<Instruction> &instructions = code.instructions;
+    std::vector<BasicBlock> blocks;
+    std::unordered_map<std::int32_t, std::size_t> labelBlocks;
+    for(std::size_t i = 0; i < instructions.size(); i++) {
+        Opcode op = instructions[i].op;
+        bool leader = i == 0 || op == Opcode::Label;
+        if(i > 0) {
+            Opcode prev = instructions[i - 1].op;
+            if(prev == Opcode::Jmp || isConditionalJump(prev) || prev == Opcode::Ret) leader = true;
+        }
+        if(leader) {
+            if(!blocks.empty()) blocks.back().end = i;
+            blocks.push_back(BasicBlock{i, instructions.size()});
+        }
+        if(op == Opcode::Label) labelBlocks.emplace(instructions[i].operands[0].symbol, blocks.size() - 1);
+    }
+
+    for(std::size_t b = 0; b < blocks.size(); b++) {
+        BasicBlock &block = blocks[b];
+        const Instruction &last = instructions[block.end - 1];
+        if(last.op == Opcode::Jmp || isConditionalJump(last.op)) {
+            std::unordered_map<std::int32_t, std::size_t>::iterator target = labelBlocks.end();
+            if(last.operands[0].type == OperandType::Symbol) target = labelBlocks.find(last.operands[0].symbol);
+            if(target == labelBlocks.end()) block.unknownSuccessor = true;
+            else block.successors.push_back(target->second);
+        }
+        // The last block falls through to the epilogue, whose popaq overwrites every register
+        if(last.op != Opcode::Jmp && last.op != Opcode::Ret && b + 1 < blocks.size()) block.successors.push_back(b + 1);
+    }
+    return blocks;
+}
+
+RegisterSet blockLiveOut(const std::vector<BasicBlock> &blocks, const BasicBlock &block) {
+    RegisterSet out = pinnedRegisters;
+    if(block.unknownSuccessor) out |= allRegisters;
+    for(std::size_t successor : block.successors) out |= blocks[successor].liveIn;
+    return out;
+}
@@ -0,0 +1,410 @@
+#include "parser.h"
+#include <iostream>
+
+struct ParserState {
+    const SourceFile &source;
+    std::size_t pos;
+};
+
+int calculateIndentation(std::string_view line)
+{
+    int indentation = 0;
+    for (char c : line)
+    {
+        if (c == ' ') indentation++;
+        else if (c == '\t') indentation += 4;
+        else break;
+    }
+    return indentation;
+}
+
+static inline bool isBlank(std::string_view line) {
+    return std::all_of(line.begin(), line.end(), [](unsigned char ch) { return std::isspace(ch); });
+}
+
+static void parseError(ParserState &state, int line, std::string message) {
+    std::cerr << "Error: " << state.source.name << ":" << line << ": " << message << std::endl;
+    exit(1);
+}
+
+static std::string slice(std::string_view line, const std::vector<Token> &tokens, std::size_t from, std::size_t to) {
+    return std::string(line.substr(tokens[from].start, tokens[to - 1].end - tokens[from].start));
+}
+
+static bool isSize(const Token &token) {
+    return token.type == TokenType::Identifier && (token.text == "byte" || token.text == "word" || token.text == "dword" || token.text == "qword");
+}
+
+static bool isRegisterArg(std::string reg) {
+    trim(reg);
+    return reg == "rax" || reg == "rbx" || reg == "rcx" || reg == "rdx";
+}
+
+struct ExprParser {
+    ParserState &state;
+    int line;
+    const std::vector<Token> &tokens;
+    std::size_t pos, end;
+};
+
+static bool peekSymbol(ExprParser &parser, std::size_t offset, const std::string &text) {
+    return parser.pos + offset < parser.end && isSymbol(parser.tokens[parser.pos + offset], text);
+}
+
+static void expectSymbol(ExprParser &parser, const std::string &text) {
+    if(!peekSymbol(parser, 0, text)) parseError(parser.state, parser.line, "expected '" + text + "'");
+    parser.pos++;
+}
+
+static std::string expectIdentifier(ExprParser &parser) {
+    if(parser.pos >= parser.end || parser.tokens[parser.pos].type != TokenType::Identifier) parseError(parser.state, parser.line, "expected an identifier");
+    return parser.tokens[parser.pos++].text;
+}
+
+// Binding power of binary operators, following C. 0 if the token is not a binary operator.
+static int binaryPrecedence(const Token &token) {
+    if(token.type != TokenType::Symbol) return 0;
+    const std::string &op = token.text;
+    if(op == "|") return 1;
+    if(op == "^") return 2;
+    if(op == "&") return 3;
+    if(op == "==" || op == "!=") return 4;
+    if(op == "<" || op == "<=" || op == ">" || op == ">=") return 5;
+    if(op == "<<" || op == ">>") return 6;
+    if(op == "+" || op == "-") return 7;
+    if(op == "*" || op == "/" || op == "%") return 8;
+    return 0;
+}
+
+Expr parseBinary(ExprParser &parser, int minPrecedence);
+
+Expr parseUnary(ExprParser &parser);
+
+Expr parsePrimary(ExprParser &parser) {
+    if(parser.pos >= parser.end) parseError(parser.state, parser.line, "expected an expression");
+    const Token &token = parser.tokens[parser.pos++];
+    switch(token.type) {
+        case TokenType::Number:
+        case TokenType::Char:
+            return Expr{ExprType::Number, token.text};
+        case TokenType::String:
+            return Expr{ExprType::String, token.text};
+        case TokenType::Identifier:
+            if(token.text == "faddr" && peekSymbol(parser, 0, "(")) {
+                parser.pos++;
+                Expr expr{ExprType::FunctionAddress, expectIdentifier(parser)};
+                expectSymbol(parser, ")");
+                return expr;
+            }
+            return Expr{ExprType::Variable, token.text};
+        case TokenType::Symbol:
+            if(token.text == "(") {
+                if(peekSymbol(parser, 0, "(") && parser.pos + 1 < parser.end && isToken(parser.tokens[parser.pos + 1], TokenType::Identifier, "struct")) {
+                    parser.pos += 2;
+                    Expr expr{ExprType::StructMember, expectIdentifier(parser)};
+                    expectSymbol(parser, ")");
+                    expr.operands.push_back(parseUnary(parser));
+                    expectSymbol(parser, ")");
+                    expectSymbol(parser, ".");
+                    expr.member = expectIdentifier(parser);
+                    return expr;
+                }
+                Expr expr = parseBinary(parser, 1);
+                expectSymbol(parser, ")");
+                return expr;
+            }
+            if(token.text == "[") {
+                Expr expr{ExprType::Dereference};
+                expr.operands.push_back(parseBinary(parser, 1));
+                expectSymbol(parser, "]");
+                return expr;
+            }
+            break;
+    }
+    parseError(parser.state, parser.line, "unexpected '" + token.text + "' in expression");
+    return Expr();
+}
+
+Expr parseUnary(ExprParser &parser) {
+    if(parser.pos < parser.end) {
+        const Token &token = parser.tokens[parser.pos];
+        if(isSymbol(token, "++") || isSymbol(token, "--") || isSymbol(token, "~") || isSymbol(token, "-") || isSymbol(token, "!")) {
+            parser.pos++;
+            Expr operand = parseUnary(parser);
+            // !x is lowered as x == 0
+            if(token.text == "!") return Expr{ExprType::Binary, "==", "", {std::move(operand), Expr{ExprType::Number, "0"}}};
+            Expr expr{ExprType::Unary, token.text};
+            expr.operands.push_back(std::move(operand));
+            return expr;
+        }
+    }
+    Expr expr = parsePrimary(parser);
+    while(peekSymbol(parser, 0, "++") || peekSymbol(parser, 0, "--")) {
+        Expr postfix{ExprType::Postfix, parser.tokens[parser.pos++].text};
+        postfix.operands.push_back(std::move(expr));
+        expr = std::move(postfix);
+    }
+    return expr;
+}
+
+// Precedence climbing: operators of equal precedence associate to the left
+Expr parseBinary(ExprParser &parser, int minPrecedence) {
+    Expr left = parseUnary(parser);
+    while(parser.pos < parser.end) {
+        int precedence = binaryPrecedence(parser.tokens[parser.pos]);
+        if(precedence == 0 || precedence < minPrecedence) break;
+        Expr expr{ExprType::Binary, parser.tokens[parser.pos++].text};
+        expr.operands.push_back(std::move(left));
+        expr.operands.push_back(parseBinary(parser, precedence + 1));
+        left = std::move(expr);
+    }
+    return left;
+}
+
+Expr parseExpression(ParserState &state, int line, const std::vector<Token> &tokens, std::size_t from, std::size_t to) {
+    ExprParser parser{state, line, tokens, from, to};
+    Expr expr = parseBinary(parser, 1);
+    if(parser.pos != parser.end) parseError(state, line, "unexpected '" + tokens[parser.pos].text + "' in expression");
+    if(expr.type == ExprType::String) parseError(state, line, "strings can only be allocated with '>'");
+    return expr;
+}
+
+Expr parseExpression(ParserState &state, int line, const std::string &text) {
+    std::vector<Token> tokens = tokenize(text);
+    return parseExpression(state, line, tokens, 0, tokens.size());
+}
+
+// Splits tokens [from, to) on commas which are not nested in brackets
+static std::vector<std::pair<std::size_t, std::size_t>> splitArgs(const std::vector<Token> &tokens, std::size_t from, std::size_t to) {
+    std::vector<std::pair<std::size_t, std::size_t>> args;
+    int depth = 0;
+    std::size_t argStart = from;
+    for(std::size_t i = from; i < to; i++) {
+        const Token &token = tokens[i];
+        if(token.type != TokenType::Symbol) continue;
+        if(token.text == "(" || token.text == "[" || token.text == "{") depth++;
+        else if(token.text == ")" || token.text == "]" || token.text == "}") depth--;
+        else if(token.text == "," && depth == 0) {
+            args.emplace_back(argStart, i);
+            argStart = i + 1;
+        }
+    }
+    if(argStart < to || !args.empty()) args.emplace_back(argStart, to);
+    return args;
+}
+
+// The right hand side of '>' may also be a string, a list ({a, b, ...}) or an empty array (size{})
+Expr parseAllocation(ParserState &state, int line, const std::vector<Token> &tokens, std::size_t from, std::size_t to) {
+    if(to - from == 1 && tokens[from].type == TokenType::String) return Expr{ExprType::String, tokens[from].text};
+    if(isSymbol(tokens[to - 1], "}")) {
+        if(isSymbol(tokens[from], "{")) {
+            Expr list{ExprType::List};
+            for(std::pair<std::size_t, std::size_t> arg : splitArgs(tokens, from + 1, to - 1)) list.operands.push_back(parseExpression(state, line, tokens, arg.first, arg.second));
+            if(list.operands.empty()) parseError(state, line, "cannot allocate an empty list");
+            return list;
+        }
+        if(to - from > 2 && isSymbol(tokens[to - 2], "{")) {
+            Expr array{ExprType::Array};
+            array.operands.push_back(parseExpression(state, line, tokens, from, to - 2));
+            return array;
+        }
+    }
+    return parseExpression(state, line, tokens, from, to);
+}
+
+AsmLine parseAsmLine(ParserState &state, int line, std::string text) {
+    AsmLine asmLine;
+    trim(text);
+
+    std::size_t open = text.find('{');
+    std::size_t close = text.rfind('}');
+    if(open != std::string::npos && close != std::string::npos && open < close) {
+        std::string inner = text.substr(open + 1, close - open - 1);
+        std::size_t comma = inner.rfind(',');
+        if(comma != std::string::npos && isRegisterArg(inner.substr(comma + 1))) {
+            asmLine.valueExpr = parseExpression(state, line, inner.substr(0, comma));
+            asmLine.valueReg = trim_copy(inner.substr(comma + 1));
+            text = text.substr(0, open) + asmLine.valueReg + text.substr(close + 1);
+        }
+    }
+
+    // Only the innermost brackets are substituted so that "[[expr, reg]]" dereferences the address
+    for(open = text.find('['); open != std::string::npos; open = text.find('[', open + 1)) {
+        close = text.find_first_of("[]", open + 1);
+        if(close == std::string::npos || text[close] != ']') continue;
+        std::string inner = text.substr(open + 1, close - open - 1);
+        std::size_t comma = inner.rfind(',');
+        if(comma == std::string::npos || !isRegisterArg(inner.substr(comma + 1))) continue;
+        asmLine.addrExpr = parseExpression(state, line, inner.substr(0, comma));
+        asmLine.addrReg = trim_copy(inner.substr(comma + 1));
+        text = text.substr(0, open) + asmLine.addrReg + text.substr(close + 1);
+        break;
+    }
+
+    asmLine.text = text;
+    return asmLine;
+}
+
+Block parseBlock(ParserState &state, int parentIndentation);
+
+static void skipBlankLines(ParserState &state) {
+    while(state.pos < state.source.lineCount() && isBlank(state.source.line(state.pos))) state.pos++;
+}
+
+Statement parseStatement(ParserState &state, int indentation) {
+    std::string_view line = state.source.line(state.pos);
+    Statement statement;
+    statement.line = state.pos + 1;
+    state.pos++;
+
+    std::vector<Token> tokens = tokenize(line);
+    std::size_t n = tokens.size();
+    const Token &first = tokens[0];
+    bool blockHeader = isSymbol(tokens[n - 1], ":");
+
+    if(isSymbol(first, "#")) {
+        if(n == 3 && isToken(tokens[1], TokenType::Identifier, "include") && tokens[2].type == TokenType::String) {
+            statement.type = StatementType::Include;
+            statement.name = tokens[2].text.substr(1, tokens[2].text.size() - 2);
+            return statement;
+        }
+        parseError(state, statement.line, "unknown directive");
+    }
+
+    if(first.type == TokenType::Identifier) {
+        if(first.text == "asm" && blockHeader && (n == 2 || (n == 3 && tokens[1].type == TokenType::Identifier))) {
+            statement.type = StatementType::Asm;
+            if(n == 3) statement.name = tokens[1].text;
+            for(;;) {
+                skipBlankLines(state);
+                if(state.pos >= state.source.lineCount()) break;
+                if(indentation >= calculateIndentation(state.source.line(state.pos))) break;
+                statement.asmLines.push_back(parseAsmLine(state, state.pos + 1, std::string(state.source.line(state.pos))));
+                state.pos++;
+            }
+            return statement;
+        }
+        if((first.text == "if" || first.text == "while") && blockHeader && n > 2) {
+            statement.type = first.text == "if" ? StatementType::If : StatementType::While;
+            statement.expr = parseExpression(state, statement.line, tokens, 1, n - 1);
+            statement.body = parseBlock(state, indentation);
+            if(statement.type == StatementType::If) {
+                skipBlankLines(state);
+                if(state.pos < state.source.lineCount() && calculateIndentation(state.source.line(state.pos)) == indentation) {
+                    std::vector<Token> elseTokens = tokenize(state.source.line(state.pos));
+                    if(elseTokens.size() == 2 && isToken(elseTokens[0], TokenType::Identifier, "else") && isSymbol(elseTokens[1], ":")) {
+                        state.pos++;
+                        statement.hasElse = true;
+                        statement.elseBody = parseBlock(state, indentation);
+                    }
+                }
+            }
+            return statement;
+        }
+        if(first.text == "else" && n == 2 && blockHeader) {
+            parseError(state, statement.line, "else without matching if");
+        }
+        if(n == 1 && (first.text == "return" || first.text == "pass" || first.text == "O0" || first.text == "O1")) {
+            if(first.text == "return") statement.type = StatementType::Return;
+            else if(first.text == "pass") statement.type = StatementType::Pass;
+            else {
+                statement.type = StatementType::Optimize;
+                statement.name = first.text;
+            }
+            return statement;
+        }
+        if(first.text == "delete" && n > 1) {
+            statement.type = StatementType::Delete;
+            statement.expr = parseExpression(state, statement.line, tokens, 1, n);
+            return statement;
+        }
+        if(first.text == "struct" && n > 1 && tokens[1].type == TokenType::Identifier) {
+            statement.type = StatementType::Struct;
+            statement.name = tokens[1].text;
+            if(n % 2 != 0) parseError(state, statement.line, "struct members must be given as <type> <name> pairs");
+            for(std::size_t i = 2; i < n; i += 2) statement.members.emplace_back(tokens[i].text, tokens[i + 1].text);
+            return statement;
+        }
+        if(first.text == "const" && n > 3 && tokens[1].type == TokenType::Identifier && isSymbol(tokens[2], "=")) {
+            statement.type = StatementType::Const;
+            statement.name = tokens[1].text;
+            statement.value = slice(line, tokens, 3, n);
+            return statement;
+        }
+    }
+
+    std::size_t targetStart = 0;
+    if(isToken(first, TokenType::Identifier, "global") && n > 1) {
+        statement.global = true;
+        targetStart++;
+    }
+    if(targetStart + 1 < n && isSize(tokens[targetStart])) {
+        statement.size = tokens[targetStart].text;
+        targetStart++;
+    }
+
+    int depth = 0;
+    for(std::size_t i = targetStart; i < n; i++) {
+        const Token &token = tokens[i];
+        if(token.type != TokenType::Symbol) continue;
+        if(token.text == "(" || token.text == "[" || token.text == "{") depth++;
+        else if(token.text == ")" || token.text == "]" || token.text == "}") depth--;
+        else if(depth == 0 && (token.text == "=" || token.text == ">" || token.text == "<")) {
+            if(i == targetStart || i + 1 == n) break;
+            statement.type = token.text == "=" ? StatementType::Assign : token.text == ">" ? StatementType::Allocate : StatementType::Store;
+            statement.target = parseExpression(state, statement.line, tokens, targetStart, i);
+            if(statement.type == StatementType::Allocate) statement.expr = parseAllocation(state, statement.line, tokens, i + 1, n);
+            else statement.expr = parseExpression(state, statement.line, tokens, i + 1, n);
+            if(!statement.size.empty() && statement.target.type != ExprType::Variable) parseError(state, statement.line, "only variables can be declared");
+            return statement;
+        }
+    }
+    if(targetStart != 0) parseError(state, statement.line, "expected an assignment");
+
+    if(n == 2 && first.type == TokenType::Identifier && blockHeader) {
+        statement.type = StatementType::Function;
+        statement.name = first.text;
+        statement.body = parseBlock(state, indentation);
+        return statement;
+    }
+
+    if(n > 2 && isSymbol(tokens[n - 1], ")")) {
+        std::size_t open = n - 1;
+        depth = 0;
+        do {
+            if(isSymbol(tokens[open], ")")) depth++;
+            else if(isSymbol(tokens[open], "(")) depth--;
+        } while(depth != 0 && open-- > 0);
+        if(depth == 0 && open > 0) {
+            statement.type = StatementType::Call;
+            // ((func)pointer)(args) calls through a function pointer
+            if(open > 5 && isSymbol(tokens[0], "(") && isSymbol(tokens[1], "(") && isToken(tokens[2], TokenType::Identifier, "func") && isSymbol(tokens[3], ")") && isSymbol(tokens[open - 1], ")")) {
+                statement.expr = parseExpression(state, statement.line, tokens, 4, open - 1);
+            } else {
+                statement.name = slice(line, tokens, 0, open);
+            }
+            for(std::pair<std::size_t, std::size_t> arg : splitArgs(tokens, open + 1, n - 1)) statement.args.push_back(parseExpression(state, statement.line, tokens, arg.first, arg.second));
+            return statement;
+        }
+    }
+
+    parseError(state, statement.line, "invalid statement: " + trim_copy(std::string(line)));
+    return statement;
+}
+
+Block parseBlock(ParserState &state, int parentIndentation) {
+    Block block;
+    for(;;) {
+        skipBlankLines(state);
+        if(state.pos >= state.source.lineCount()) break;
+        int indentation = calculateIndentation(state.source.line(state.pos));
+        if(indentation <= parentIndentation) break;
+        block.push_back(parseStatement(state, indentation));
+    }
+    return block;
+}
+
+Block parseSource(const SourceFile &source) {
+    ParserState state{source, 0};
+    return parseBlock(state, -1);
+}
@@ -0,0 +1,158 @@
+#include "profile.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <vector>
+#ifdef _WIN32
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static std::atomic<std::size_t> allocationCount(0);
+
+// Every allocation in the compiler goes through here so that phases can report how many they made
+void *operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if(size == 0) size = 1;
+    while(true) {
+        void *memory = std::malloc(size);
+        if(memory) return memory;
+        std::new_handler handler = std::get_new_handler();
+        if(!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+struct PhaseReport {
+    std::string name;
+    double milliseconds;
+    std::size_t allocations;
+    std::size_t peakMemory;
+};
+
+struct TraceEvent {
+    std::string name;
+    const char *category;
+    long long start, duration;
+    int thread;
+};
+
+static bool timeReportEnabled = false, traceEnabled = false;
+static std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+static std::mutex profileMutex;
+static std::vector<PhaseReport> phases;
+static std::vector<std::pair<std::string, std::size_t>> counters;
+static std::vector<TraceEvent> traceEvents;
+static std::atomic<int> nextThread(0);
+
+static long long now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+static int threadId() {
+    thread_local int id = nextThread++;
+    return id;
+}
+
+// Peak resident set size in KiB
+static std::size_t peakMemory() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS memory;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory))) return 0;
+    return memory.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void enableTimeReport() {
+    timeReportEnabled = true;
+}
+
+void enableTrace() {
+    traceEnabled = true;
+}
+
+ProfileScope::ProfileScope(const std::string &name, const char *category) : active(timeReportEnabled || traceEnabled), category(category) {
+    if(!active) return;
+    this->name = name;
+    start = now();
+    startAllocations = allocationCount.load(std::memory_order_relaxed);
+}
+
+ProfileScope::~ProfileScope() {
+    if(!active) return;
+    long long end = now();
+    std::lock_guard<std::mutex> lock(profileMutex);
+    if(timeReportEnabled && std::strcmp(category, "phase") == 0) {
+        phases.push_back(PhaseReport{name, (end - start) / 1000.0, allocationCount.load(std::memory_order_relaxed) - startAllocations, peakMemory()});
+    }
+    if(traceEnabled) traceEvents.push_back(TraceEvent{name, category, start, end - start, threadId()});
+}
+
+void recordCounter(const std::string &name, std::size_t value) {
+    if(!timeReportEnabled) return;
+    std::lock_guard<std::mutex> lock(profileMutex);
+    counters.emplace_back(name, value);
+}
+
+static std::string escapeJson(const std::string &str) {
+    std::string escaped;
+    for(char c : str) {
+        if(c == '"' || c == '\\') escaped += '\\';
+        if(static_cast<unsigned char>(c) < 0x20) escaped += string_format("\\u%04x", c);
+        else escaped += c;
+    }
+    return escaped;
+}
+
+void finishProfile(const std::string &tracePath) {
+    if(timeReportEnabled) {
+        double totalTime = 0;
+        std::size_t totalAllocations = 0;
+        std::cerr << string_format("%-16s %12s %12s %16s\n", "Phase", "Time (ms)", "Allocations", "Peak RSS (KiB)");
+        for(const PhaseReport &phase : phases) {
+            std::cerr << string_format("%-16s %12.3f %12zu %16zu\n", phase.name.c_str(), phase.milliseconds, phase.allocations, phase.peakMemory);
+            totalTime += phase.milliseconds;
+            totalAllocations += phase.allocations;
+        }
+        std::cerr << string_format("%-16s %12.3f %12zu %16zu\n", "Total", totalTime, totalAllocations, peakMemory());
+        for(const std::pair<std::string, std::size_t> &counter : counters) std::cerr << counter.first << ": " << counter.second << "\n";
+    }
+
+    if(traceEnabled && !tracePath.empty()) {
+        std::ofstream os(tracePath);
+        os << "{\"traceEvents\":[\n";
+        for(std::size_t i = 0; i < traceEvents.size(); i++) {
+            const TraceEvent &event = traceEvents[i];
+            os << string_format("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d}",
+                escapeJson(event.name).c_str(), event.category, event.start, event.duration, event.thread);
+            os << (i + 1 < traceEvents.size() ? ",\n" : "\n");
+        }
+        os << "]}\n";
+        os.close();
+    }
+}
@@ -0,0 +1,199 @@
+#include "regalloc.h"
+#include <algorithm>
+#include <cmath>
+
+// Callee saved in both the Windows and System V ABIs, and never used by generated code
+static const Register localRegisters[] = {Register::r12, Register::r13, Register::r14, Register::r15};
+
+struct LiveInterval {
+    std::map<std::string, Variable> *scope;
+    std::string name;
+    int function;
+    int start, end;
+    double weight = 0;
+    bool pinned = false; // Must stay in memory
+};
+
+struct ScopeEntry {
+    std::map<std::string, Variable> *variables;
+    int function;
+};
+
+struct LoopEntry {
+    int start;
+    std::vector<std::size_t> intervals; // Intervals referenced within the loop
+};
+
+class IntervalBuilder {
+public:
+    std::vector<LiveInterval> intervals;
+    std::vector<bool> functionHasAsm;
+
+    IntervalBuilder(ScopeTable &scopes) : scopes(scopes) {}
+
+    void block(const Block &block, int function) {
+        ScopeTable::iterator scope = scopes.find(&block);
+        chain.push_back(ScopeEntry{scope == scopes.end() ? nullptr : &scope->second, function});
+        for(const Statement &statement : block) this->statement(statement, function);
+        chain.pop_back();
+    }
+
+private:
+    ScopeTable &scopes;
+    std::vector<ScopeEntry> chain;
+    std::vector<LoopEntry> loops;
+    std::map<std::pair<std::map<std::string, Variable>*, std::string>, std::size_t> intervalIndex;
+    int position = 0;
+
+    void statement(const Statement &statement, int function) {
+        position++;
+        switch(statement.type) {
+            case StatementType::Asm:
+                if(function >= 0) functionHasAsm[function] = true;
+                for(const AsmLine &asmLine : statement.asmLines) {
+                    if(!asmLine.valueReg.empty()) expr(asmLine.valueExpr, function, false);
+                    if(!asmLine.addrReg.empty()) expr(asmLine.addrExpr, function, true);
+                }
+                return;
+            case StatementType::Assign:
+            case StatementType::Allocate:
+                expr(statement.expr, function, false);
+                expr(statement.target, function, statement.target.type != ExprType::Variable);
+                return;
+            case StatementType::Store:
+            case StatementType::Delete:
+                expr(statement.target, function, false);
+                expr(statement.expr, function, false);
+                return;
+            case StatementType::Call:
+                expr(statement.expr, function, false);
+                for(const Expr &arg : statement.args) expr(arg, function, false);
+                return;
+            case StatementType::Function:
+                functionHasAsm.push_back(false);
+                block(statement.body, functionHasAsm.size() - 1);
+                return;
+            case StatementType::If:
+                expr(statement.expr, function, false);
+                block(statement.body, function);
+                if(statement.hasElse) block(statement.elseBody, function);
+                return;
+            case StatementType::While: {
+                loops.push_back(LoopEntry{position});
+                expr(statement.expr, function, false);
+                block(statement.body, function);
+                position++;
+                // Values must survive the back edge, so anything used in the loop is live for all of it
+                LoopEntry loop = loops.back();
+                loops.pop_back();
+                for(std::size_t index : loop.intervals) {
+                    intervals[index].start = std::min(intervals[index].start, loop.start);
+                    intervals[index].end = std::max(intervals[index].end, position);
+                }
+                if(!loops.empty()) loops.back().intervals.insert(loops.back().intervals.end(), loop.intervals.begin(), loop.intervals.end());
+                return;
+            }
+            default:
+                return;
+        }
+    }
+
+    void expr(const Expr &expr, int function, bool addressTaken) {
+        if(expr.type == ExprType::Variable) {
+            reference(expr.text, function, addressTaken);
+            return;
+        }
+        for(std::size_t i = 0; i < expr.operands.size(); i++) {
+            // Struct members are found at an offset from the address of their operand
+            this->expr(expr.operands[i], function, expr.type == ExprType::StructMember && i == 0);
+        }
+    }
+
+    void reference(const std::string &name, int function, bool addressTaken) {
+        position++;
+        for(std::size_t i = chain.size(); i-- > 0;) {
+            std::map<std::string, Variable> *scope = chain[i].variables;
+            if(scope == nullptr) continue;
+            std::map<std::string, Variable>::iterator variable = scope->find(name);
+            if(variable == scope->end()) continue;
+            if(chain[i].function < 0 || variable->second.storage != StorageClass::Stack) return;
+
+            std::pair<std::map<std::string, Variable>*, std::string> key(scope, name);
+            std::map<std::pair<std::map<std::string, Variable>*, std::string>, std::size_t>::iterator it = intervalIndex.find(key);
+            if(it == intervalIndex.end()) {
+                it = intervalIndex.emplace(key, intervals.size()).first;
+                intervals.push_back(LiveInterval{scope, name, chain[i].function, position, position});
+                intervals.back().pinned = variable->second.size != 8;
+            }
+            LiveInterval &interval = intervals[it->second];
+            interval.end = position;
+            interval.weight += std::pow(8.0, std::min<std::size_t>(loops.size(), 6)); // Uses in loops count for more
+            if(addressTaken || chain[i].function != function) interval.pinned = true;
+            if(!loops.empty()) loops.back().intervals.push_back(it->second);
+            return;
+        }
+    }
+};
+
+void allocateRegisters(const Block &program, ScopeTable &scopes) {
+    IntervalBuilder builder(scopes);
+    builder.block(program, -1);
+
+    std::vector<LiveInterval*> candidates;
+    for(LiveInterval &interval : builder.intervals) {
+        if(!interval.pinned && !builder.functionHasAsm[interval.function]) candidates.push_back(&interval);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const LiveInterval *a, const LiveInterval *b) {
+        if(a->function != b->function) return a->function < b->function;
+        return a->start < b->start;
+    });
+
+    const std::size_t registerCount = sizeof(localRegisters) / sizeof(localRegisters[0]);
+    std::vector<LiveInterval*> active; // Intervals holding registers, indexed by register
+    for(std::size_t i = 0; i < candidates.size(); i++) {
+        LiveInterval *interval = candidates[i];
+        if(i == 0 || candidates[i - 1]->function != interval->function) active.assign(registerCount, nullptr);
+
+        std::size_t chosen = registerCount;
+        for(std::size_t r = 0; r < registerCount; r++) {
+            if(active[r] != nullptr && active[r]->end < interval->start) active[r] = nullptr;
+            if(active[r] == nullptr && chosen == registerCount) chosen = r;
+        }
+        if(chosen == registerCount) {
+            // Under pressure, the least used of the overlapping intervals is the one left in memory
+            std::size_t lightest = 0;
+            for(std::size_t r = 1; r < registerCount; r++) if(active[r]->weight < active[lightest]->weight) lightest = r;
+            if(active[lightest]->weight >= interval->weight) continue;
+            Variable &spilled = active[lightest]->scope->at(active[lightest]->name);
+            spilled.storage = StorageClass::Stack;
+            spilled.reg = Register::None;
+            chosen = lightest;
+        }
+        active[chosen] = interval;
+        Variable &variable = interval->scope->at(interval->name);
+        variable.storage = StorageClass::Register;
+        variable.reg = localRegisters[chosen];
+    }
+}
+
+static void collectRegisters(const ScopeTable &scopes, const Block &block, std::vector<Register> &registers) {
+    ScopeTable::const_iterator scope = scopes.find(&block);
+    if(scope != scopes.end()) {
+        for(const std::pair<const std::string, Variable> &variable : scope->second) {
+            if(variable.second.storage == StorageClass::Register) registers.push_back(variable.second.reg);
+        }
+    }
+    for(const Statement &statement : block) {
+        if(statement.type != StatementType::If && statement.type != StatementType::While) continue;
+        collectRegisters(scopes, statement.body, registers);
+        if(statement.hasElse) collectRegisters(scopes, statement.elseBody, registers);
+    }
+}
+
+std::vector<Register> functionRegisters(const ScopeTable &scopes, const Block &body) {
+    std::vector<Register> registers;
+    collectRegisters(scopes, body, registers);
+    std::sort(registers.begin(), registers.end());
+    registers.erase(std::unique(registers.begin(), registers.end()), registers.end());
+    return registers;
+}
@@ -0,0 +1,79 @@
+#include "source.h"
+#include "utils.h"
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static void sourceError(const std::string &fileName) {
+    std::cerr << "Error: cannot read input file: " << fileName << std::endl;
+    exit(1);
+}
+
+#ifdef _WIN32
+
+SourceFile::SourceFile(const std::string &fileName) : name(fileName) {
+    fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(fileHandle == INVALID_HANDLE_VALUE) sourceError(fileName);
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(fileHandle, &fileSize)) sourceError(fileName);
+    size = static_cast<std::size_t>(fileSize.QuadPart);
+    if(size != 0) {
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mappingHandle) sourceError(fileName);
+        data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if(!data) sourceError(fileName);
+    }
+    indexLines();
+}
+
+SourceFile::~SourceFile() {
+    if(data) UnmapViewOfFile(data);
+    if(mappingHandle) CloseHandle(mappingHandle);
+    if(fileHandle && fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+}
+
+#else
+
+SourceFile::SourceFile(const std::string &fileName) : name(fileName) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd < 0) sourceError(fileName);
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0) sourceError(fileName);
+    size = static_cast<std::size_t>(fileStat.st_size);
+    if(size != 0) {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED) sourceError(fileName);
+        data = static_cast<const char*>(mapping);
+    }
+    close(fd);
+    indexLines();
+}
+
+SourceFile::~SourceFile() {
+    if(data) munmap(const_cast<char*>(data), size);
+}
+
+#endif
+
+void SourceFile::indexLines() {
+    std::size_t start = 0;
+    while(start < size) {
+        const char *newline = static_cast<const char*>(memchr(data + start, '\n', size - start));
+        std::size_t end = newline ? newline - data : size;
+        std::string_view line(data + start, end - start);
+        if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        lines.emplace_back(start, find_comment(line));
+        start = end + 1;
+    }
+}
+
+std::shared_ptr<SourceFile> loadSource(const std::string &fileName) {
+    return std::make_shared<SourceFile>(fileName);
+}
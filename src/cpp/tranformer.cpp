@@ -1,142 +1,325 @@
 #include "transformer.h"
+#include "liveness.h"
+#include "profile.h"
 
-std::string matOps = "mov|add|sub|mul|div|and|or|xor|not|shl|shr|rol|ror";
-std::string regs = "(r|e)?(?:[a-d](?:l|h|x)|(?:si|di|bp|sp)l?|ss|cs|ds|es|fs|gs)";
+std::int64_t get_mask(Register reg) {
+    switch(registerSize(reg)) {
+        case 1: return 0xFF;
+        case 2: return 0xFFFF;
+        case 4: return 0xFFFFFFFF;
+    }
+    return -1;
+}
 
-std::string get_full_reg(std::string reg) {
-    if(reg[0] == 'r') return reg;
-    if(reg[0] == 'e') return "r" + reg.substr(1);
-    if(reg[1] == 'h') return string_format("r%cx", reg[0]);
-    if(reg.size() == 3 && reg[2] == 'l') return "r" + reg.substr(0, reg.size()-1);
-    return "r" + reg;
+bool isRegisterMove(const Instruction &instruction) {
+    return instruction.op == Opcode::Mov
+        && instruction.operands[0].type == OperandType::Register
+        && instruction.operands[1].type == OperandType::Register;
 }
 
-std::string get_mask(std::string reg) {
-    if(reg[0] == 'r') return "0xFFFFFFFFFFFFFFFF";
-    if(reg[0] == 'e') return "0xFFFFFFFF";
-    if(reg.back() == 'l' || reg.back() == 'h') return "0xFF";
-    return "0xFFFF";
+bool removeSelfMove(const Instruction *instructions, std::vector<Instruction> &replacement) {
+    return isRegisterMove(instructions[0]) && instructions[0].operands[0].reg == instructions[0].operands[1].reg;
 }
 
-std::size_t lookahead(std::string line, std::vector<std::string> lines, int i) {
-    for(std::size_t j = i; j < lines.size(); j++) {
-        if(lines[j] == line) return true;
-        if(lines[j].back() == ':' || lines[j] == "ret") return j;
-    }
-    return std::string::npos;
+// Widen partial register moves so that the upper bits of the destination are well defined
+bool widenSource(const Instruction *instructions, std::vector<Instruction> &replacement) {
+    const Operand &dst = instructions[0].operands[0], &src = instructions[0].operands[1];
+    if(!isRegisterMove(instructions[0]) || registerSize(src.reg) == 8) return false;
+    replacement.push_back(Instruction{Opcode::Mov, {dst, registerOperand(fullRegister(src.reg))}});
+    replacement.push_back(Instruction{Opcode::And, {dst, immediateOperand(get_mask(src.reg))}});
+    return true;
+}
+
+bool widenDestination(const Instruction *instructions, std::vector<Instruction> &replacement) {
+    const Operand &dst = instructions[0].operands[0], &src = instructions[0].operands[1];
+    if(!isRegisterMove(instructions[0]) || registerSize(dst.reg) == 8) return false;
+    replacement.push_back(Instruction{Opcode::Mov, {registerOperand(fullRegister(dst.reg)), src}});
+    replacement.push_back(Instruction{Opcode::And, {registerOperand(fullRegister(dst.reg)), immediateOperand(get_mask(dst.reg))}});
+    return true;
+}
+
+// NASM cannot infer the size of an immediate stored to memory, so it is stored as a qword like a variable
+bool sizeImmediateStore(const Instruction *instructions, std::vector<Instruction> &replacement) {
+    const Operand &dst = instructions[0].operands[0], &src = instructions[0].operands[1];
+    if(instructions[0].op != Opcode::Mov || dst.type != OperandType::Memory || dst.size != 0 || src.type != OperandType::Immediate) return false;
+    replacement.push_back(instructions[0]);
+    replacement.back().operands[0].size = 8;
+    return true;
 }
 
-int transform_code(std::vector<std::string> &lines) {
-    if(lines.size() < 3) return 0;
-    std::vector<std::string> transformedLines;
+const std::vector<PeepholeRule> &peepholeRules() {
+    static const std::vector<PeepholeRule> rules = {
+        {"remove self move", 1, removeSelfMove},
+        {"widen partial source", 1, widenSource},
+        {"widen partial destination", 1, widenDestination},
+        {"size immediate store", 1, sizeImmediateStore}
+    };
+    return rules;
+}
+
+int transform_code(Code &code) {
+    const std::vector<PeepholeRule> &rules = peepholeRules();
+    int maxWindow = 1;
+    for(const PeepholeRule &rule : rules) maxWindow = std::max(maxWindow, rule.window);
+
+    // Instructions still to be examined, in reverse order. Rewrites are pushed back onto it, so only the code around a change is revisited
+    std::vector<Instruction> worklist(code.instructions.rbegin(), code.instructions.rend());
+    std::vector<Instruction> &output = code.instructions;
+    output.clear();
+
+    std::vector<std::size_t> fired(rules.size());
+    std::vector<Instruction> replacement;
+    std::size_t barrier = 0; // Windows may not reach back past this index of the output
+    bool optimizationEnabled = true;
     int numTransformations = 0;
-    bool optimizationEnabled = lines[0] != ";arsenic_o0";
-    std::vector<std::string> removedPops;
-    transformedLines.push_back(lines[0]);
-    for(std::size_t i = 1; i < lines.size() - 1; i++) {
-        std::string line = lines[i];
-        if(!optimizationEnabled) {
-            transformedLines.push_back(line);
-            if(line == ";arsenic_o1") optimizationEnabled = true;
+
+    while(!worklist.empty()) {
+        output.push_back(worklist.back());
+        worklist.pop_back();
+        const Instruction &instruction = output.back();
+
+        if(!optimizationEnabled || instruction.op == Opcode::OptimizeOff || instruction.op == Opcode::OptimizeOn) {
+            if(instruction.op == Opcode::OptimizeOff) optimizationEnabled = false;
+            else if(instruction.op == Opcode::OptimizeOn) optimizationEnabled = true;
+            barrier = output.size();
             continue;
         }
-        if(line == ";arsenic_o0") {
-            transformedLines.push_back(line);
-            optimizationEnabled = false;
-            continue;
+
+        for(std::size_t i = 0; i < rules.size(); i++) {
+            std::size_t window = rules[i].window;
+            if(output.size() - barrier < window) continue;
+            replacement.clear();
+            if(!rules[i].rewrite(&output[output.size() - window], replacement)) continue;
+
+            fired[i]++;
+            numTransformations++;
+            output.resize(output.size() - window);
+            worklist.insert(worklist.end(), replacement.rbegin(), replacement.rend());
+            // Step back so that windows which now overlap the replacement are examined again
+            for(int j = 1; j < maxWindow && output.size() > barrier; j++) {
+                worklist.push_back(output.back());
+                output.pop_back();
+            }
+            break;
         }
+    }
 
-        std::string prev = lines[i - 1];
-        std::string next = lines[i + 1];
+    for(std::size_t i = 0; i < rules.size(); i++) {
+        if(fired[i] != 0) recordCounter(std::string("peephole ") + rules[i].name, fired[i]);
+    }
 
-        std::smatch match;
+    return numTransformations;
+}
 
-        if(std::regex_match(line, match, std::regex(string_format("(%s)\\s+(.+),\\s*(%s)", matOps.c_str(), regs.c_str())))) {
-            std::string op = match[1];
-            std::string dst = match[2];
-            std::string src = match[3];
+static bool isRegisterOperation(const Instruction &instruction, Opcode op) {
+    return instruction.op == op
+        && instruction.operands[0].type == OperandType::Register
+        && registerSize(instruction.operands[0].reg) == 8
+        && instruction.operands[0].reg != Register::rsp
+        && instruction.operands[0].reg != Register::rbp;
+}
 
-            if(op == "mov" && dst == src) {
-                numTransformations++;
-                continue;
-            }
+static bool usesStackMemory(const Instruction &instruction) {
+    for(const Operand &operand : instruction.operands) {
+        if(operand.type == OperandType::Memory && operand.reg == Register::rsp) return true;
+    }
+    return false;
+}
 
-            // if(std::regex_match(src, std::regex(regs)) && std::regex_match(prev, match, std::regex(string_format("mov %s, (.+)", src.c_str())))) {
-            //     transformedLines.push_back(string_format("%s %s, %s", op.c_str(), dst.c_str(), match[1].c_str()));
-            // } // Could cause problems with cases where vars are expected to stay in `src`
-            if(op == "mov" && dst[0] == '[' && src[0] <= '9') {
-                transformedLines.push_back(string_format("mov %s, qword %s", dst.c_str(), src.c_str()));
-                numTransformations++;
+// Frees bytes from the top of the stack in pairSaves. Returns false if the stack held less than that
+static bool releaseStack(std::vector<std::pair<std::size_t, std::int64_t>> &stack, std::int64_t bytes) {
+    while(bytes > 0 && !stack.empty()) {
+        std::int64_t freed = std::min(bytes, stack.back().second);
+        bytes -= freed;
+        stack.back().second -= freed;
+        if(stack.back().second == 0) stack.pop_back();
+    }
+    return bytes == 0;
+}
+
+// Pairs every push with the pop which restores it, in one walk which tracks the stack through straight line code. Instructions without a partner are
+// left at npos. Barriers forget everything on the stack, since its layout is no longer known past them
+static std::vector<std::size_t> pairSaves(const std::vector<Instruction> &instructions) {
+    std::vector<std::size_t> partner(instructions.size(), std::string::npos);
+    // The push which made each region of the stack and its size, or npos for space made some other way
+    std::vector<std::pair<std::size_t, std::int64_t>> stack;
+    for(std::size_t i = 0; i < instructions.size(); i++) {
+        const Instruction &instruction = instructions[i];
+        if(usesStackMemory(instruction) || isConditionalJump(instruction.op)) {
+            stack.clear();
+            continue;
+        }
+        const Operand &dst = instruction.operands[0], &src = instruction.operands[1];
+        switch(instruction.op) {
+            case Opcode::Push:
+            case Opcode::Pushfq:
+                stack.emplace_back(instruction.op == Opcode::Push ? i : std::string::npos, 8);
+                continue;
+            case Opcode::Pop:
+            case Opcode::Popfq:
+                if(instruction.op == Opcode::Pop && !stack.empty() && stack.back().first != std::string::npos) {
+                    partner[i] = stack.back().first;
+                    partner[stack.back().first] = i;
+                }
+                if(!releaseStack(stack, 8)) stack.clear();
+                continue;
+            case Opcode::Add:
+            case Opcode::Sub:
+                if(dst.type == OperandType::Register && fullRegister(dst.reg) == Register::rsp) {
+                    std::int64_t grow = instruction.op == Opcode::Sub ? src.value : -src.value;
+                    if(src.type != OperandType::Immediate || grow % 8 != 0) stack.clear();
+                    else if(grow > 0) stack.emplace_back(std::string::npos, grow);
+                    else if(!releaseStack(stack, -grow)) stack.clear();
+                }
+                continue;
+            case Opcode::Call:
+                continue;
+            case Opcode::Label:
+            case Opcode::Jmp:
+            case Opcode::Ret:
+            case Opcode::Raw:
+            case Opcode::Enter:
+            case Opcode::Leave:
+            case Opcode::Pushaq:
+            case Opcode::Popaq:
+            case Opcode::OptimizeOff:
+            case Opcode::OptimizeOn:
+                stack.clear();
+                continue;
+            default: {
+                RegisterSet uses, defs;
+                instructionEffects(instruction, uses, defs);
+                if(defs & registerBit(Register::rsp)) stack.clear();
                 continue;
             }
+        }
+    }
+    return partner;
+}
+
+struct SaveElimination {
+    std::vector<Instruction> &instructions;
+    std::vector<bool> enabled, removed, needed;
+    std::vector<std::size_t> partner;
+    std::size_t deadSaves = 0, mergedSaves = 0;
+
+    // The push which saves the register a pop restores, if the pair can be removed
+    std::size_t save(std::size_t pop) {
+        std::size_t push = partner[pop];
+        if(!enabled[pop] || !isRegisterOperation(instructions[pop], Opcode::Pop) || push == std::string::npos || !enabled[push]) return std::string::npos;
+        if(!isRegisterOperation(instructions[push], Opcode::Push) || instructions[push].operands[0].reg != instructions[pop].operands[0].reg) return std::string::npos;
+        return push;
+    }
 
-            if(src[0] == '[' || dst[0] == '[') {
-                transformedLines.push_back(line);
+    // Walks a block backwards from its liveOut and returns the registers live at its start. A save only reads its register if the value it
+    // restores is read, so that saves which would only keep each other alive around a loop are found to be dead
+    RegisterSet liveness(const BasicBlock &block) {
+        RegisterSet live = block.liveOut;
+        for(std::size_t i = block.end; i-- > block.begin;) {
+            const Instruction &instruction = instructions[i];
+            std::size_t push = save(i);
+            if(push != std::string::npos) {
+                needed[push] = live & registerBit(instruction.operands[0].reg);
+                if(!needed[push]) continue;
+            } else if(partner[i] != std::string::npos && save(partner[i]) == i && !needed[i]) {
                 continue;
             }
+            RegisterSet uses, defs;
+            instructionEffects(instruction, uses, defs);
+            live = uses | (live & ~defs);
+        }
+        return live;
+    }
 
-            if(op == "mov" && src[0] != 'r' && std::regex_match(src, std::regex(regs))) {
-                transformedLines.push_back(string_format("mov %s, %s", dst.c_str(), get_full_reg(src).c_str()));
-                transformedLines.push_back(string_format("and %s, %s", dst.c_str(), get_mask(src).c_str()));
-                numTransformations++;
+    // Walks a block backwards from its liveOut, removing saves of registers which are dead once they are restored
+    void eliminate(const BasicBlock &block) {
+        RegisterSet live = block.liveOut;
+        // The pushes of dead registers which follow the current instruction, nearest last, with the registers live after each
+        std::vector<std::pair<std::size_t, RegisterSet>> pending;
+        for(std::size_t i = block.end; i-- > block.begin;) {
+            if(removed[i]) continue;
+            const Instruction &instruction = instructions[i];
+            Register reg = instruction.operands[0].reg;
+            bool pop = enabled[i] && isRegisterOperation(instruction, Opcode::Pop);
+
+            // Restoring a register and immediately saving it again leaves the same value on the stack, so the pair can go if the register is dead afterwards.
+            // This joins the saves of consecutive statements into one, and once a pair is gone the pop before it meets the push after it
+            if(pop && !pending.empty() && instructions[pending.back().first].operands[0].reg == reg) {
+                std::size_t push = pending.back().first;
+                removed[i] = removed[push] = true;
+                std::size_t save = partner[i], restore = partner[push];
+                if(save != std::string::npos) partner[save] = restore;
+                if(restore != std::string::npos) partner[restore] = save;
+                live = pending.back().second;
+                pending.pop_back();
+                mergedSaves++;
                 continue;
             }
 
-            if(op == "mov" && dst[0] != 'r' && std::regex_match(dst, std::regex(regs))) {
-                transformedLines.push_back(string_format("mov %s, %s", get_full_reg(dst).c_str(), src.c_str()));
-                transformedLines.push_back(string_format("and %s, %s", get_full_reg(dst).c_str(), get_mask(dst).c_str()));
-                numTransformations++;
+            // A register which is dead once it has been restored did not need to be saved
+            std::size_t push = save(i);
+            if(push != std::string::npos && !(live & registerBit(reg))) {
+                removed[i] = removed[push] = true;
+                deadSaves++;
                 continue;
             }
+
+            if(enabled[i] && isRegisterOperation(instruction, Opcode::Push) && !(live & registerBit(reg))) pending.emplace_back(i, live);
+            else pending.clear();
+            RegisterSet uses, defs;
+            instructionEffects(instruction, uses, defs);
+            live = uses | (live & ~defs);
         }
+    }
+};
 
-        // Push/pop optimization is currently bugged and will be fixed in the future
-        // if(std::regex_match(line, match, std::regex(string_format("push (%s)", regs.c_str())))) {
-        //     std::string reg = match[1];
-        //     bool regModified = false;
-        //     for(std::size_t j = i + 1; j < lines.size(); j++) {
-        //         if(lines[j].back() == ':' || lines[j] == "ret") break;
-        //         if(line == lines[j]) break;
-        //         if(lines[j].find(reg) != std::string::npos || lines[j].rfind("int ", 0) == 0 || lines[j].rfind("call ", 0) == 0) {
-        //             regModified = true;
-        //             break;
-        //         }
-        //     }
-        //     std::size_t popLoc;
-        //     if(regModified) {
-        //         transformedLines.push_back(line);
-        //     } else if((popLoc = lookahead("pop " + reg , lines, i)) != std::string::npos) {
-        //         for(std::size_t j = popLoc + 1; j < lines.size(); j++) {
-        //             if(lines[j].back() == ':' || lines[j] == "ret") break;
-        //             if(line == lines[j]) break;
-        //             if(lines[j].find(reg) != std::string::npos || lines[j].rfind("int ", 0) == 0 || lines[j].rfind("call ", 0) == 0) {
-        //                 if(std::regex_match(lines[j], std::regex(string_format("mov %s,((?!%s).)*", reg.c_str(), reg.c_str())))) break;
-        //                 regModified = true;
-        //                 break;
-        //             }
-        //         }
-        //         if(regModified) transformedLines.push_back(line);
-        //         else removedPops.push_back("pop " + reg);
-        //         numTransformations++;
-        //     }
-        //     continue;
-        // }
-
-        // if(removedPops.size() && removedPops.back() == line) {
-        //     removedPops.pop_back();
-        //     numTransformations++;
-        //     continue;
-        // }
-
-        transformedLines.push_back(line);
+int eliminate_saves(Code &code) {
+    std::vector<Instruction> &instructions = code.instructions;
+    std::size_t count = instructions.size();
+    SaveElimination elimination{instructions, std::vector<bool>(count), std::vector<bool>(count), std::vector<bool>(count), pairSaves(instructions)};
+    bool optimizationEnabled = true;
+    for(std::size_t i = 0; i < count; i++) {
+        if(instructions[i].op == Opcode::OptimizeOff) optimizationEnabled = false;
+        else if(instructions[i].op == Opcode::OptimizeOn) optimizationEnabled = true;
+        elimination.enabled[i] = optimizationEnabled;
     }
-    transformedLines.push_back(lines[lines.size()-1]);
 
-    if(removedPops.size()) {
-        std::cerr << "Error: stack is likely corrupted after optimization! (Please debug the program)" << std::endl;
-        exit(1);
+    std::vector<BasicBlock> blocks = findBasicBlocks(code);
+    std::vector<std::vector<std::size_t>> predecessors(blocks.size());
+    for(std::size_t b = 0; b < blocks.size(); b++) {
+        for(std::size_t successor : blocks[b].successors) predecessors[successor].push_back(b);
     }
 
-    lines = transformedLines;
-    return numTransformations;
+    // Liveness starts out empty and grows until it settles, so registers which are only read by saves of themselves are never found live.
+    // Each block is revisited at most once per register which becomes live at its end
+    std::vector<std::size_t> worklist(blocks.size());
+    for(std::size_t b = 0; b < blocks.size(); b++) worklist[b] = b;
+    std::vector<bool> queued(blocks.size(), true);
+    while(!worklist.empty()) {
+        std::size_t b = worklist.back();
+        worklist.pop_back();
+        queued[b] = false;
+        blocks[b].liveOut = blockLiveOut(blocks, blocks[b]);
+        RegisterSet in = elimination.liveness(blocks[b]);
+        if(in == blocks[b].liveIn) continue;
+        blocks[b].liveIn = in;
+        for(std::size_t predecessor : predecessors[b]) {
+            if(!queued[predecessor]) {
+                queued[predecessor] = true;
+                worklist.push_back(predecessor);
+            }
+        }
+    }
+
+    for(const BasicBlock &block : blocks) elimination.eliminate(block);
+
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < count; i++) {
+        if(!elimination.removed[i]) instructions[kept++] = instructions[i];
+    }
+    instructions.resize(kept);
+
+    if(elimination.deadSaves != 0) recordCounter("dead saves removed", elimination.deadSaves);
+    if(elimination.mergedSaves != 0) recordCounter("adjacent saves merged", elimination.mergedSaves);
+    return elimination.deadSaves + elimination.mergedSaves;
 }
@@ -1,18 +1,6 @@
 #include "utils.h"
-
-bool matchingBrackets(std::string str) {
-    std::string brackets;
-    for(char c : str) {
-        if(c == '(' || c == '[') brackets += c;
-        else if(c == ')' || c == ']') {
-            if(brackets.empty()) return false;
-            if(brackets.back() == '(' && c == ')') brackets.pop_back();
-            else if(brackets.back() == '[' && c == ']') brackets.pop_back();
-            else return false;
-        }
-    }
-    return brackets.size() == 0;
-}
+#include <atomic>
+#include <thread>
 
 std::string string_replace(std::string str, std::string search, std::string replace) {
     size_t pos = 0;
@@ -23,28 +11,33 @@ std::string string_replace(std::string str, std::string search, std::string repl
     return str;
 }
 
-std::size_t find_not_in_brackets(std::string str, std::string find) {
-    std::size_t loc = 0;
-    int numBrackets = 0;
-    for(char c: str) {
-        if(c == '(' || c == '[') numBrackets++;
-        else if(c == ')' || c == ']') numBrackets--;
-        else if(c == find[0] && numBrackets == 0) {
-            std::size_t pos = str.find(find, loc);
-            if(pos == std::string::npos) return std::string::npos;
-            if(pos == loc) return loc;
+std::size_t find_comment(std::string_view str) {
+    bool quotes = false;
+    for(std::size_t i = 0; i < str.length(); i++) {
+        if(str[i] == '"' || str[i] == '\'') {
+            quotes = !quotes;
+        }
+        if(quotes && str[i] == '\\') {
+            i++;
+            continue;
         }
-        loc++;
+        if(';' == str[i] && !quotes) return i;
     }
-    return std::string::npos;
+    return str.length();
 }
 
-std::vector<std::string> split(std::string str, char delimiter) {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(str);
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
+void parallel_for(std::size_t count, unsigned jobs, const std::function<void(std::size_t)> &task) {
+    if(jobs > count) jobs = count;
+    if(jobs <= 1) {
+        for(std::size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < jobs; i++) {
+        workers.emplace_back([&]() {
+            for(std::size_t j; (j = next++) < count;) task(j);
+        });
     }
-    return tokens;
+    for(std::thread &worker : workers) worker.join();
 }
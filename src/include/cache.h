@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include "includes.h"
+
+// Identifies the running compiler binary, so that rebuilding the compiler invalidates cached output
+std::string compilerIdentity(const char *argv0);
+
+// Hashes the contents of every file in the include graph together with the settings that affect the output
+std::string cacheKey(const IncludeGraph &graph, const std::string &settings);
+
+bool readCache(const std::string &cacheDir, const std::string &key, std::string &output);
+
+void writeCache(const std::string &cacheDir, const std::string &key, const std::string &output);
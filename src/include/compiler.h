@@ -1,22 +1,32 @@
 #pragma once
 #include <fstream>
-#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <regex>
+#include <set>
 #include <string>
 #include <vector>
+#include "ir.h"
+#include "parser.h"
 #include "utils.h"
 
 struct Context;
 
+enum class StorageClass {
+    Stack, // A local in the frame of the scope that declares it
+    Global,
+    Const,
+    Arg, // The address of the arguments of the current function, which are stored above its return address
+    Ret, // The return value slot of the current function. Values given by return = value are returned in rax instead
+    Register // A local kept in a register by allocateRegisters
+};
+
 struct Variable {
-    std::string name;
-    std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int)> getAddr;
-    std::function<void(std::shared_ptr<Context>, std::string, std::string, std::vector<std::string>&, int, int, int)> getValue;
+    StorageClass storage;
     int size;
-    bool onStack = true;
+    int offset = 0; // Position in the frame of the function that declares it, assigned by layoutFunction
+    Register reg = Register::None;
 };
 
 struct Struct_ {
@@ -24,93 +34,132 @@ struct Struct_ {
     int size;
 };
 
+typedef std::map<const Block*, std::map<std::string, Variable>> ScopeTable;
+
+// Functions which use a variable of an enclosing function or of the root scope, keyed by the scope which declares them and their name.
+// Their callers pass the frame pointer of that scope in r10
+typedef std::set<std::pair<const std::map<std::string, Variable>*, std::string>> LinkTable;
+
+// Scopes are created on the stack while their block is compiled and linked to their parent by plain pointers
 struct Context {
     std::string name;
-    std::map<std::string, Variable> variables;
+    const std::map<std::string, Variable> *variables; // The scope's entry in the ScopeTable
     std::map<std::string, Struct_> structs;
     std::map<std::string, std::string> functions;
-    std::shared_ptr<Context> parent, root;
-    int depth, nestedLevel;
+    Context *parent, *root;
+    bool frame; // Whether the scope has a frame of its own. Only functions and the root do, and blocks share the frame of their function
+    int unit; // Index of the file being compiled
+    std::vector<Register> savedRegisters; // Registers holding locals of the function, which are restored when it returns
+    bool signedComparisons = false; // Whether <, <=, > and >= treat their operands as signed. Read from the root
+    LinkTable linkedFunctions; // Read from the root
 };
 
-int findVariableOffset(std::string var, std::map<std::string, Variable> variables);
+// Assigns the variables of a scope offsets in its frame, starting at base. Returns the offset after the last one
+int layoutFrame(std::map<std::string, Variable> &variables, int base);
+
+// Lays out the frame of a function, or of the root scope given one of its files, along with the frames of the functions it declares.
+// The variables of its blocks are placed after its own. Must be called once every scope's variables are final. Returns the frame's size
+int layoutFunction(ScopeTable &scopes, std::map<std::string, Variable> &variables, const Block &body);
+
+// The size of the frame of the function with the given body, once it has been laid out
+int frameSize(const ScopeTable &scopes, const Block &body);
+
+// Finds the variable a name refers to from ctx, or returns nullptr
+const Variable *findVariable(Context *ctx, const std::string &name);
 
 void resolve_argument_a(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string>& compiledCode,
-    int numParents
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
 );
 
 void resolve_argument_i(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string> &compiledCode,
-    int numParents
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
 );
 
 void resolve_argument_p(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string> &compiledCode,
-    std::vector<std::string> &definitions,
-    int numParents
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode,
+    std::vector<std::string> &definitions
 );
 
-bool resolve_argument_o(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::string operation,
-    std::function<void(std::vector<std::string>&)> printAsm,
-    std::vector<std::string> &compiledCode
+void resolve_argument_o(
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
 );
 
 void resolve_argument(
-    std::shared_ptr<Context> ctx,
-    std::string var,
-    std::string reg,
-    std::vector<std::string> &compiledCode
+    Context *ctx,
+    const Expr &var,
+    Register reg,
+    Code &compiledCode
+);
+
+void discoverScopes(
+    Context *ctx,
+    const Block &block,
+    ScopeTable &scopes,
+    std::map<std::string, Variable> &globals,
+    std::vector<std::string> &definitions,
+    bool function
 );
 
-std::map<std::string, Variable> preprocessFunction(
-    std::shared_ptr<Context> ctx,
-    int indentation,
-    std::function<std::unique_ptr<std::string>()> getLine,
-    std::ifstream &file
+const std::map<std::string, Variable> &findScope(const ScopeTable &scopes, const Block &block);
+
+std::string getFunctionLabel(Context *ctx, std::string name);
+
+void declareTopLevel(
+    Context *ctx,
+    const Block &program,
+    const ScopeTable &scopes
 );
 
+std::string scopeLabel(Context *ctx);
+
 std::string allocateLabel(
     std::string requestedName,
-    std::shared_ptr<Context> ctx
+    Context *ctx
 );
 
 std::map<std::string, Variable> defaultVars();
 
-Variable var(std::string name, int size);
+Variable var(int size);
 
-Variable constVar(std::string name);
+Variable constVar();
 
-Variable globalVar(std::string name, int size);
+Variable globalVar(int size);
 
-int getVarSize(std::string size);
+// Emits code which finds the frame of owner, a scope enclosing ctx, using reg if it is not ctx's own frame. Returns the register holding it
+Register emitFramePointer(Context *ctx, Context *owner, Register reg, Code &compiledCode);
 
-std::string getGlobalSize(int varSize);
+// Emits code which loads the address of a variable declared in owner into reg, from code in ctx
+void emitVariableAddress(Context *ctx, Context *owner, const std::string &name, const Variable &variable, Register reg, Code &compiledCode);
 
-std::string getSizedRegister(std::string reg, int size);
+// Emits code which loads the value of a variable declared in owner into reg, from code in ctx
+void emitVariableValue(Context *ctx, Context *owner, const std::string &name, const Variable &variable, Register reg, Code &compiledCode);
 
-std::string getSizeMask(int size);
+bool isComparison(const std::string &operation);
+
+Opcode comparisonOpcode(const std::string &operation, bool signedComparison);
+
+int getVarSize(std::string size);
+
+std::string getGlobalSize(int varSize);
 
-int stackSize(std::map<std::string, Variable> vars);
+std::int64_t getSizeMask(int size);
 
 void compileLine(
-    std::shared_ptr<Context> ctx,
-    std::string line,
-    std::function<std::unique_ptr<std::string>()> getLine,
-    std::vector<std::string>& compiledCode,
-    std::vector<std::string>& definitions,
-    std::ifstream& file
+    Context *ctx,
+    const Statement &statement,
+    const ScopeTable &scopes,
+    Code &compiledCode,
+    std::vector<std::string>& definitions
 );
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "ir.h"
+
+// Accumulates the generated assembly in a single buffer, so that it can be written with a few large writes
+class AsmWriter {
+public:
+    explicit AsmWriter(std::size_t capacity = 1 << 20);
+
+    void text(std::string_view text);
+
+    void line(std::string_view text);
+
+    void number(std::int64_t value);
+
+    void instruction(const Code &code, const Instruction &instruction);
+
+    const std::string &buffer() const { return out; }
+
+private:
+    std::string out;
+
+    void operand(const Code &code, const Operand &operand);
+};
+
+// Writes contents to path in large chunks. Returns false if the file could not be written
+bool writeOutput(const std::string &path, std::string_view contents);
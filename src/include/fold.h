@@ -0,0 +1,7 @@
+#pragma once
+#include <vector>
+#include "parser.h"
+
+// Evaluates constant subexpressions at compile time. The values of consts and of locals which are only assigned a constant where they are
+// declared are substituted for their uses, and if/else bodies and loops which can never run are removed. Must be run before scopes are discovered
+void foldConstants(std::vector<Block> &programs, bool signedComparisons);
@@ -0,0 +1,8 @@
+#pragma once
+#include <vector>
+#include "compiler.h"
+
+// Finds the functions which use a variable of an enclosing function or of the root scope, directly or through the functions they call or declare.
+// Each gets a .link slot in its frame, which its prologue fills with the frame pointer its callers pass in r10, and is added to links.
+// Must be run once every scope has been discovered and registers have been allocated, before frames are laid out
+void linkFrames(const std::vector<Block> &programs, ScopeTable &scopes, std::map<std::string, Variable> &rootVariables, LinkTable &links);
@@ -0,0 +1,20 @@
+#pragma once
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "source.h"
+
+struct IncludeGraph {
+    std::vector<std::string> files; // Inputs followed by their includes, breadth first, each listed once
+    std::vector<std::shared_ptr<SourceFile>> sources; // The loaded source of each file
+};
+
+void getIncludes(const SourceFile &source, std::vector<std::string> &includes);
+
+IncludeGraph buildIncludeGraph(
+    const std::vector<std::string> &inputFiles,
+    const std::vector<std::filesystem::path> &includePath,
+    unsigned jobs
+);
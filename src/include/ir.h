@@ -0,0 +1,155 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum class Opcode : std::uint8_t {
+    Mov,
+    Movzx,
+    Lea,
+    Add,
+    Sub,
+    Mul,
+    Imul, // Only the two operand form, which keeps the low 64 bits of dst * src
+    Div,
+    And,
+    Or,
+    Xor,
+    Not,
+    Neg,
+    Inc,
+    Dec,
+    Shl,
+    Shr,
+    Cmp,
+    Test,
+    Sete,
+    Setne,
+    Setb, // Unsigned comparisons
+    Setbe,
+    Seta,
+    Setae,
+    Setl, // Signed comparisons
+    Setle,
+    Setg,
+    Setge,
+    Push,
+    Pop,
+    Call,
+    Ret,
+    Jmp,
+    Jz, // Conditional jumps, in the same order as the setcc instructions
+    Jnz,
+    Jb,
+    Jbe,
+    Ja,
+    Jae,
+    Jl,
+    Jle,
+    Jg,
+    Jge,
+    Enter,
+    Leave,
+    Lahf,
+    Pushfq,
+    Popfq,
+    Pushaq, // Macro which pushes every general purpose register
+    Popaq,
+    RepMovsb,
+    Label, // operands[0] is the label
+    Raw, // Assembly which is passed through untouched. operands[0] is its text
+    OptimizeOff, // Disables the optimizer until the next OptimizeOn
+    OptimizeOn
+};
+
+// Registers of each size are listed in the same order, so that the index of a register within its size is the same for every size
+enum class Register : std::uint8_t {
+    None,
+    rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp, r8, r9, r10, r11, r12, r13, r14, r15,
+    eax, ebx, ecx, edx, esi, edi, ebp, esp, r8d, r9d, r10d, r11d, r12d, r13d, r14d, r15d,
+    ax, bx, cx, dx, si, di, bp, sp, r8w, r9w, r10w, r11w, r12w, r13w, r14w, r15w,
+    al, bl, cl, dl, sil, dil, bpl, spl, r8b, r9b, r10b, r11b, r12b, r13b, r14b, r15b,
+    ah, bh, ch, dh
+};
+
+enum class OperandType : std::uint8_t {
+    None,
+    Register,
+    Immediate,
+    Memory, // [reg + symbol + value]
+    Symbol // A label or other name which is used as an immediate
+};
+
+struct Operand {
+    OperandType type = OperandType::None;
+    Register reg = Register::None; // The register, or the base of a memory operand
+    std::uint8_t size = 0; // Explicit size of a memory operand in bytes, or 0 if it is implied
+    std::int32_t symbol = -1; // Index into the symbols of the Code
+    std::int64_t value = 0; // The immediate, or the displacement of a memory operand
+};
+
+struct Instruction {
+    Opcode op;
+    Operand operands[2];
+};
+
+// A sequence of instructions and the names they refer to
+class Code {
+public:
+    std::vector<Instruction> instructions;
+    std::vector<std::string> symbols;
+
+    std::int32_t symbol(std::string_view name);
+
+    void emit(Opcode op, Operand dst = Operand(), Operand src = Operand());
+
+    void label(std::string_view name);
+
+    // Adds a line of user assembly. Lines which are single instructions the compiler understands are added as such
+    void assembly(std::string_view text);
+
+    Operand symbolOperand(std::string_view name);
+
+    Operand symbolMemory(std::string_view name, int size = 0);
+
+    // Appends other, translating its symbols into this Code's
+    void append(const Code &other);
+
+private:
+    std::unordered_map<std::string, std::int32_t> symbolIndex;
+};
+
+Operand registerOperand(Register reg);
+
+Operand immediateOperand(std::int64_t value);
+
+Operand memoryOperand(Register base, std::int64_t displacement = 0, int size = 0);
+
+const char *opcodeName(Opcode op);
+
+bool isConditionalJump(Opcode op);
+
+// The conditional jump which is taken when the setcc instruction would set its operand
+Opcode jumpForSet(Opcode set);
+
+// The NASM size specifier for an operand of size bytes
+const char *sizeName(int size);
+
+Register parseRegister(std::string_view name);
+
+const char *registerName(Register reg);
+
+int registerSize(Register reg);
+
+// The 64 bit register which contains reg
+Register fullRegister(Register reg);
+
+Register sizedRegister(Register reg, int size);
+
+// Parses a NASM integer or character literal, which may be negated
+bool parseImmediate(std::string_view text, std::int64_t &value);
+
+// Converts a literal from the source into an operand, falling back to passing its text through unchanged
+Operand literalOperand(Code &code, std::string_view text);
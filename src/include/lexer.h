@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class TokenType {
+    Identifier,
+    Number,
+    Char,
+    String,
+    Symbol
+};
+
+struct Token {
+    TokenType type;
+    std::string text;
+    std::size_t start, end; // Offsets of the token in the source line
+};
+
+bool isToken(const Token &token, TokenType type, const std::string &text);
+
+bool isSymbol(const Token &token, const std::string &text);
+
+std::vector<Token> tokenize(std::string_view line);
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "ir.h"
+
+// A set of 64 bit registers. Bit i is set for the register at position i + 1 in Register
+typedef std::uint32_t RegisterSet;
+
+const RegisterSet allRegisters = 0xFFFF;
+
+RegisterSet registerBit(Register reg);
+
+// The registers an instruction reads and the registers it overwrites completely. Assembly the compiler does not understand is assumed to read
+// every register, and calls and returns follow the calling convention
+void instructionEffects(const Instruction &instruction, RegisterSet &uses, RegisterSet &defs);
+
+struct BasicBlock {
+    std::size_t begin, end; // Instructions [begin, end)
+    RegisterSet liveIn = 0, liveOut = 0;
+    std::vector<std::size_t> successors;
+    bool unknownSuccessor = false; // Control may leave to somewhere outside of the code
+};
+
+// Splits code into basic blocks and finds their successors
+std::vector<BasicBlock> findBasicBlocks(const Code &code);
+
+// The registers live after a block, given the liveIn of its successors
+RegisterSet blockLiveOut(const std::vector<BasicBlock> &blocks, const BasicBlock &block);
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "lexer.h"
+#include "source.h"
+#include "utils.h"
+
+enum class StatementType {
+    Asm,
+    Assign, // target = value
+    Allocate, // target > value
+    Store, // target < value
+    Function,
+    Return,
+    Delete,
+    If,
+    While,
+    Call,
+    Optimize,
+    Struct,
+    Const,
+    Include,
+    Pass
+};
+
+enum class ExprType {
+    Number, // Numeric and character literals
+    String,
+    Variable,
+    FunctionAddress, // faddr(name)
+    StructMember, // ((struct name)operand).member
+    Dereference, // [operand]
+    Unary, // ++, --, ~, - and ! applied before the operand
+    Postfix, // ++ and -- applied after the operand
+    Binary,
+    List, // {a, b, ...}, only valid in allocations
+    Array // size{}, only valid in allocations
+};
+
+struct Expr {
+    ExprType type = ExprType::Number;
+    std::string text; // Literal, variable/function name, operator, or struct name
+    std::string member;
+    std::vector<Expr> operands;
+};
+
+struct AsmLine {
+    std::string text;
+    Expr valueExpr; // {expr, reg}
+    std::string valueReg;
+    Expr addrExpr; // [expr, reg]
+    std::string addrReg;
+};
+
+struct Statement;
+
+typedef std::vector<Statement> Block;
+
+struct Statement {
+    StatementType type;
+    int line;
+    std::string name;
+    std::string value;
+    std::string size;
+    bool global = false;
+    Expr target, expr;
+    std::vector<Expr> args;
+    std::vector<std::pair<std::string, std::string>> members;
+    std::vector<AsmLine> asmLines;
+    Block body, elseBody;
+    bool hasElse = false;
+};
+
+int calculateIndentation(std::string_view line);
+
+Block parseSource(const SourceFile &source);
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+void enableTimeReport();
+
+void enableTrace();
+
+// Times a region of the compiler. Phases are totalled for --time-report, and every region is added to the trace
+class ProfileScope {
+public:
+    ProfileScope(const std::string &name, const char *category = "phase");
+    ~ProfileScope();
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope &operator=(const ProfileScope&) = delete;
+
+private:
+    bool active;
+    std::string name;
+    const char *category;
+    long long start;
+    std::size_t startAllocations;
+};
+
+// Records a named count, such as the number of transformer iterations, for --time-report
+void recordCounter(const std::string &name, std::size_t value);
+
+// Writes the time report to stderr and the trace to its file, if either was requested
+void finishProfile(const std::string &tracePath);
@@ -0,0 +1,11 @@
+#pragma once
+#include <vector>
+#include "compiler.h"
+
+// Keeps the most used qword locals of each function in callee saved registers, using linear scan over the order their references appear in.
+// Variables whose address is taken, which nested functions refer to, or which belong to functions containing asm stay in the frame.
+// Must be run once every scope has been discovered
+void allocateRegisters(const Block &program, ScopeTable &scopes);
+
+// The registers holding locals of the function with the given body, which it must save and restore
+std::vector<Register> functionRegisters(const ScopeTable &scopes, const Block &body);
@@ -0,0 +1,34 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A source file mapped read-only into memory, with the start and (comment stripped) length of every line
+class SourceFile {
+public:
+    std::string name;
+
+    SourceFile(const std::string &fileName);
+    ~SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile &operator=(const SourceFile&) = delete;
+
+    std::size_t lineCount() const { return lines.size(); }
+
+    std::string_view line(std::size_t i) const { return std::string_view(data + lines[i].first, lines[i].second); }
+
+    std::string_view contents() const { return std::string_view(data, size); }
+
+private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+    std::vector<std::pair<std::size_t, std::size_t>> lines;
+#ifdef _WIN32
+    void *fileHandle = nullptr, *mappingHandle = nullptr;
+#endif
+
+    void indexLines();
+};
+
+std::shared_ptr<SourceFile> loadSource(const std::string &fileName);
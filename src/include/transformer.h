@@ -1,12 +1,20 @@
 #pragma once
-#include <fstream>
-#include <functional>
 #include <iostream>
-#include <map>
-#include <memory>
-#include <regex>
-#include <string>
 #include <vector>
-#include "utils.h"
+#include "ir.h"
 
-int transform_code(std::vector<std::string> &lines);
+// A peephole rewrite. window is the number of consecutive instructions the rule inspects, ending with the newest one
+struct PeepholeRule {
+    const char *name;
+    int window;
+    // Returns true and fills replacement if the instructions should be rewritten
+    bool (*rewrite)(const Instruction *instructions, std::vector<Instruction> &replacement);
+};
+
+const std::vector<PeepholeRule> &peepholeRules();
+
+// Applies the peephole rules until none of them match. Returns the number of rewrites, and records how often each rule fired
+int transform_code(Code &code);
+
+// Removes pushes and pops which save registers that are dead once they are restored. Returns the number of pairs removed
+int eliminate_saves(Code &code);
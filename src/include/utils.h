@@ -1,11 +1,14 @@
 #pragma once
 #include <algorithm>
+#include <functional>
 #include <cctype>
 #include <locale>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 
 // Credit for trim functions: Evan Teran https://stackoverflow.com/questions/216823/how-to-trim-a-stdstring
 // trim from start (in place)
@@ -58,17 +61,10 @@ std::string string_format( const std::string& format, Args ... args )
     return std::string( buf.get(), buf.get() + size - 1 ); // We don't want the '\0' inside
 }
 
-bool matchingBrackets(std::string str);
-
-// Credit tshepang && Joseph https://stackoverflow.com/questions/874134/find-out-if-string-ends-with-another-string-in-c
-inline bool ends_with(std::string const & value, std::string const & ending)
-{
-    if (ending.size() > value.size()) return false;
-    return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
-}
-
 std::string string_replace(std::string str, std::string search, std::string replace);
 
-std::size_t find_not_in_brackets(std::string str, std::string find);
+// Returns the index where the comment on a line starts, or its length if it has none
+std::size_t find_comment(std::string_view str);
 
-std::vector<std::string> split(std::string str, char delimiter);
+// Runs task(0) ... task(count - 1) on up to `jobs` threads
+void parallel_for(std::size_t count, unsigned jobs, const std::function<void(std::size_t)> &task);
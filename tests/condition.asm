@@ -0,0 +1,91 @@
+[bits 64]
+DEFAULT REL
+%macro pushaq 0
+push rax
+push rbx
+push rcx
+push rdx
+push r8
+push r9
+push r10
+push r11
+push r12
+push r13
+push r14
+push r15
+push rsi
+push rdi
+%endmacro
+%macro popaq 0
+pop rdi
+pop rsi
+pop r15
+pop r14
+pop r13
+pop r12
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdx
+pop rcx
+pop rbx
+pop rax
+%endmacro
+arsenic:
+push rbp
+mov rbp, rsp
+sub rsp, 8
+pushaq
+pushfq
+jmp arsenic_ff_e
+arsenic_ff:
+push rbp
+mov rbp, rsp
+sub rsp, 16
+lea rax, [rbp-16]
+mov rbx, 3
+mov [rax], rbx
+mov rax, 1
+arsenic_ff_cif0:
+push rax
+mov rax, [rbp-16]
+cmp rax, 3
+pop rax
+jnz arsenic_ff_cif0_cel
+push rax
+lea rax, [rbp-16]
+mov rbx, 4
+mov [rax], rbx
+pop rax
+arsenic_ff_cif0_cel:
+arsenic_ff_cif0_e:
+lea rbx, [rbp-16]
+mov [rbx], rax
+mov rax, [rbp-16]
+cmp rax, 10
+jae arsenic_ff_cwhile0_e
+arsenic_ff_cwhile0:
+lea rax, [rbp-16]
+push rax
+mov rax, [rbp-16]
+mov rbx, 1
+add rax, rbx
+mov rbx, rax
+pop rax
+mov [rax], rbx
+mov rax, [rbp-16]
+cmp rax, 10
+jb arsenic_ff_cwhile0
+arsenic_ff_cwhile0_e:
+mov rax, [rbp-16]
+leave
+ret
+arsenic_ff_e:
+sub rsp, 32
+call arsenic_ff
+add rsp, 32
+popfq
+popaq
+leave
+ret
@@ -0,0 +1,99 @@
+[bits 64]
+DEFAULT REL
+%macro pushaq 0
+push rax
+push rbx
+push rcx
+push rdx
+push r8
+push r9
+push r10
+push r11
+push r12
+push r13
+push r14
+push r15
+push rsi
+push rdi
+%endmacro
+%macro popaq 0
+pop rdi
+pop rsi
+pop r15
+pop r14
+pop r13
+pop r12
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdx
+pop rcx
+pop rbx
+pop rax
+%endmacro
+arsenic:
+push rbp
+mov rbp, rsp
+sub rsp, 8
+pushaq
+pushfq
+jmp arsenic_fratio_e
+arsenic_fratio:
+push rbp
+mov rbp, rsp
+sub rsp, 40
+mov [rbp+16], rcx
+mov [rbp+24], rdx
+mov [rbp+32], r8
+mov [rbp+40], r9
+lea rax, [rbp-32]
+lea rbx, [rbp+16]
+mov [rax], rbx
+lea rax, [rbp-16]
+mov rbx, [rbp-32]
+mov rbx, [rbx]
+mov [rax], rbx
+lea rax, [rbp-32]
+push rax
+mov rax, [rbp-32]
+mov rbx, 8
+add rax, rbx
+mov rbx, rax
+pop rax
+mov [rax], rbx
+lea rax, [rbp-24]
+mov rbx, [rbp-32]
+mov rbx, [rbx]
+mov [rax], rbx
+lea rax, [rbp-40]
+push rax
+mov rax, [rbp-16]
+mov rbx, [rbp-24]
+xor rdx, rdx
+div rbx
+mov rbx, rax
+pop rax
+mov [rax], rbx
+mov rax, [rbp-40]
+push rax
+mov rax, [rbp-16]
+mov rbx, [rbp-24]
+xor rdx, rdx
+div rbx
+mov rax, rdx
+mov rbx, rax
+pop rax
+add rax, rbx
+leave
+ret
+arsenic_fratio_e:
+sub rsp, 32
+mov rcx, 100
+mov rdx, 7
+call arsenic_fratio
+add rsp, 32
+popfq
+popaq
+leave
+ret